@@ -13,6 +13,7 @@ LOCAL_SRC_FILES := \
 	util.c \
 	main.c \
 	checksum.c \
+	simd-checksum-x86_64.c \
 	match.c \
 	syscall.c \
 	log.c \
@@ -33,6 +34,12 @@ LOCAL_SRC_FILES := \
 	xattrs.c \
 	progress.c \
 	pipe.c \
+	workers.c \
+	cdc.c \
+	uring.c \
+	sumcache.c \
+	evloop.c \
+	bwlimit.c \
 	params.c \
 	loadparm.c \
 	clientserver.c \
@@ -44,6 +51,9 @@ LOCAL_SRC_FILES := \
 	lib/snprintf.c \
 	lib/mdfour.c \
 	lib/md5.c \
+	lib/xxh64.c \
+	lib/crc32c.c \
+	lib/zeros.c \
 	lib/permstring.c \
 	lib/pool_alloc.c \
 	lib/sysacls.c \
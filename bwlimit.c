@@ -0,0 +1,340 @@
+/*
+ * Keeping the socket I/O within the --bwlimit rate.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+/*
+ * Each direction (BWL_OUT and BWL_IN) has a token bucket that fills at the
+ * --bwlimit rate until it holds a burst's worth of bytes.  The data that
+ * we write to (or read from) the socket is taken out of the bucket, and
+ * when that leaves it more than a millisecond short, we sleep for just
+ * the time it takes to even out.  No single read or write is allowed to
+ * be bigger than the burst, so a fast link never gets much ahead of the
+ * limit.  The time comes from a monotonic clock where we have one, so a
+ * change to the system's time can't stall the transfer (or let it race).
+ *
+ * A daemon that runs its own accept loop also sets up (before it forks any
+ * children) a small shared-memory table of buckets for its "daemon
+ * bwlimit" and each module's "module bwlimit", which all the connections
+ * draw from.  These are kept as the time at which the data moved so far
+ * will have been paid for (the "GCRA" form of a token bucket), which one
+ * compare-and-swap can update, so the connections never block each other.
+ * Each one reserves its share as it moves data and sleeps until then, so
+ * the busy connections take turns getting whatever the idle ones leave.
+ */
+
+#include "rsync.h"
+
+#if !defined MAP_ANONYMOUS && defined MAP_ANON
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#if defined HAVE_MMAP && defined MAP_ANONYMOUS && defined HAVE_SYNC_BUILTINS
+#define SHARED_BWLIMIT 1
+#endif
+
+extern int bwlimit;
+extern int bwlimit_burst;
+
+#define ONE_SEC	1000000L /* # of microseconds in a second */
+#define MIN_SLEEP_USEC 1000L /* a shorter debt waits for the next I/O */
+
+#define MAX_SHARED_BUCKETS 64 /* the daemon's plus 63 modules' */
+#define SHARED_NAME_LEN 64
+#define STATUS_SECS 5 /* how often the "bwlimit status file" is written */
+
+static struct bw_bucket {
+	double tokens;	/* bytes we may move now (negative when behind) */
+	int64 last_usec; /* when tokens was last brought up to date */
+} buckets[2];
+
+static int64 now_usec(void)
+{
+	struct timeval tv;
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+	static int no_monotonic;
+	struct timespec ts;
+
+	if (!no_monotonic) {
+		if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+			return (int64)ts.tv_sec * ONE_SEC + ts.tv_nsec / 1000;
+		/* Don't mix the two clocks' times in a bucket. */
+		no_monotonic = 1;
+		buckets[BWL_OUT].last_usec = buckets[BWL_IN].last_usec = 0;
+	}
+#endif
+
+	gettimeofday(&tv, NULL);
+	return (int64)tv.tv_sec * ONE_SEC + tv.tv_usec;
+}
+
+/* The burst defaults to an eighth of a second's worth of data. */
+static double burst_size(int burst, int kbps)
+{
+	double size = burst ? burst : (double)kbps * 128;
+
+	return size < MIN_BWLIMIT_BURST ? MIN_BWLIMIT_BURST : size;
+}
+
+/* Take bytes out of our own bucket, returning how long we need to sleep
+ * to be back within the limit. */
+static int64 charge_bucket(int dir, size_t bytes, int64 now)
+{
+	struct bw_bucket *b = &buckets[dir];
+	double rate = (double)bwlimit * 1024; /* bytes per second */
+	double burst = burst_size(bwlimit_burst, bwlimit);
+
+	if (!b->last_usec)
+		b->tokens = burst;
+	else if (now > b->last_usec) {
+		b->tokens += (double)(now - b->last_usec) * rate / ONE_SEC;
+		if (b->tokens > burst)
+			b->tokens = burst;
+	}
+	b->last_usec = now;
+
+	if ((b->tokens -= bytes) >= 0)
+		return 0;
+	return (int64)(-b->tokens * ONE_SEC / rate);
+}
+
+#ifdef SHARED_BWLIMIT
+struct shared_bucket {
+	char name[SHARED_NAME_LEN]; /* the module's name ("" if unused) */
+	int kbps;		/* the limit that was last put on it */
+	int64 paid_nsec[2];	/* when the data so far will have been paid for */
+	int64 bytes[2];		/* how much data has been moved */
+};
+
+static struct shared_bwlimits {
+	int lock;		/* held while a module claims a bucket */
+	struct shared_bucket bucket[MAX_SHARED_BUCKETS]; /* [0] is the daemon's */
+} *shared;
+
+static struct shared_bucket *joined[2]; /* the daemon's and the module's */
+static int joined_kbps[2];
+
+/* Reserve the time to move bytes from a shared bucket, returning how long
+ * we need to sleep until that time comes. */
+static int64 charge_shared(struct shared_bucket *sb, int kbps, int dir,
+			   size_t bytes, int64 now)
+{
+	double rate = (double)kbps * 1024;
+	int64 burst_nsec = (int64)(burst_size(0, kbps) * ONE_SEC * 1000 / rate);
+	int64 cost_nsec = (int64)(bytes * (ONE_SEC * 1000.0) / rate);
+	int64 now_nsec = now * 1000, old, paid;
+
+	__sync_fetch_and_add(&sb->bytes[dir], (int64)bytes);
+
+	do {
+		old = sb->paid_nsec[dir];
+		paid = old > now_nsec - burst_nsec ? old : now_nsec - burst_nsec;
+		paid += cost_nsec;
+	} while (!__sync_bool_compare_and_swap(&sb->paid_nsec[dir], old, paid));
+
+	return (paid - burst_nsec - now_nsec) / 1000;
+}
+#endif
+
+/* Return how much of len bytes the next read or write may move. */
+size_t bwlimit_max_io(size_t len)
+{
+	double burst;
+#ifdef SHARED_BWLIMIT
+	int j;
+
+	for (j = 0; j < 2; j++) {
+		if (!joined[j])
+			continue;
+		burst = burst_size(0, joined_kbps[j]);
+		if (len > burst)
+			len = (size_t)burst;
+	}
+#endif
+
+	if (bwlimit <= 0)
+		return len;
+
+	burst = burst_size(bwlimit_burst, bwlimit);
+	return len > burst ? (size_t)burst : len;
+}
+
+/* Take the bytes that were just written (BWL_OUT) or read (BWL_IN) out of
+ * that direction's buckets, sleeping if that puts us behind a limit. */
+void bwlimit_account(int dir, size_t bytes)
+{
+	int64 now, sleep_usec = 0;
+	struct timeval tv;
+#ifdef SHARED_BWLIMIT
+	int64 usec;
+	int j;
+
+	if (bwlimit <= 0 && !joined[0] && !joined[1])
+		return;
+#else
+	if (bwlimit <= 0)
+		return;
+#endif
+
+	now = now_usec();
+
+	if (bwlimit > 0)
+		sleep_usec = charge_bucket(dir, bytes, now);
+#ifdef SHARED_BWLIMIT
+	for (j = 0; j < 2; j++) {
+		if (!joined[j])
+			continue;
+		usec = charge_shared(joined[j], joined_kbps[j], dir, bytes, now);
+		if (usec > sleep_usec)
+			sleep_usec = usec;
+	}
+#endif
+
+	if (sleep_usec < MIN_SLEEP_USEC)
+		return;
+
+	tv.tv_sec = sleep_usec / ONE_SEC;
+	tv.tv_usec = sleep_usec % ONE_SEC;
+	select(0, NULL, NULL, NULL, &tv);
+}
+
+/* Called by the daemon before it starts forking off connections. */
+void bwlimit_shared_init(void)
+{
+#ifdef SHARED_BWLIMIT
+	void *mem = mmap(NULL, sizeof shared[0], PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (mem == MAP_FAILED) {
+		rsyserr(FLOG, errno, "unable to share the daemon's bwlimits");
+		return;
+	}
+	shared = mem; /* mmap() zeroed it */
+#endif
+}
+
+/* A daemon connection to a module starts drawing from the daemon's shared
+ * bucket and the module's (for whichever of them has a limit). */
+void bwlimit_shared_join(const char *module, int module_kbps, int daemon_kbps)
+{
+#ifdef SHARED_BWLIMIT
+	struct shared_bucket *sb = NULL;
+	int j;
+
+	if (!shared)
+		return;
+
+	if (daemon_kbps > 0) {
+		joined[0] = &shared->bucket[0];
+		joined_kbps[0] = joined[0]->kbps = daemon_kbps;
+	}
+
+	if (module_kbps <= 0)
+		return;
+
+	/* Modules whose names only differ after the first SHARED_NAME_LEN-1
+	 * chars share a bucket. */
+	while (__sync_lock_test_and_set(&shared->lock, 1))
+		msleep(1);
+	for (j = 1; j < MAX_SHARED_BUCKETS; j++) {
+		sb = &shared->bucket[j];
+		if (!*sb->name) {
+			strlcpy(sb->name, module, SHARED_NAME_LEN);
+			break;
+		}
+		if (strncmp(sb->name, module, SHARED_NAME_LEN - 1) == 0)
+			break;
+	}
+	__sync_lock_release(&shared->lock);
+
+	if (j == MAX_SHARED_BUCKETS) {
+		rprintf(FLOG, "too many modules to share the module bwlimit of %s\n",
+			module);
+		return;
+	}
+	joined[1] = sb;
+	joined_kbps[1] = sb->kbps = module_kbps;
+#endif
+}
+
+#ifdef SHARED_BWLIMIT
+static void write_status_file(const char *fn, double secs)
+{
+	static int64 prior_bytes[MAX_SHARED_BUCKETS][2];
+	char tmpbuf[MAXPATHLEN];
+	struct shared_bucket *sb;
+	double rate[2];
+	int64 bytes;
+	FILE *fp;
+	int j, d;
+
+	if (snprintf(tmpbuf, sizeof tmpbuf, "%s.tmp", fn) >= (int)sizeof tmpbuf)
+		return;
+	if (!(fp = fopen(tmpbuf, "w"))) {
+		rsyserr(FLOG, errno, "unable to write %s", tmpbuf);
+		return;
+	}
+
+	fprintf(fp, "%-24s %10s %10s %10s %16s %16s\n", "bucket",
+		"limit KB/s", "out KB/s", "in KB/s", "bytes out", "bytes in");
+	for (j = 0; j < MAX_SHARED_BUCKETS; j++) {
+		sb = &shared->bucket[j];
+		if (j && !*sb->name)
+			break;
+		for (d = 0; d < 2; d++) {
+			bytes = sb->bytes[d];
+			rate[d] = secs ? (bytes - prior_bytes[j][d]) / 1024.0 / secs : 0;
+			prior_bytes[j][d] = bytes;
+		}
+		fprintf(fp, "%-24s %10d %10.1f %10.1f %16.0f %16.0f\n",
+			j ? sb->name : "(daemon)", sb->kbps, rate[BWL_OUT],
+			rate[BWL_IN], (double)prior_bytes[j][BWL_OUT],
+			(double)prior_bytes[j][BWL_IN]);
+	}
+
+	if (fclose(fp) != 0 || rename(tmpbuf, fn) < 0) {
+		rsyserr(FLOG, errno, "unable to write %s", fn);
+		unlink(tmpbuf);
+	}
+}
+#endif
+
+/* The daemon's accept loop calls this to keep the "bwlimit status file"
+ * up to date.  Returns how many seconds until it should be called again,
+ * or 0 if there's no file to write. */
+int bwlimit_shared_status(void)
+{
+#ifdef SHARED_BWLIMIT
+	static int64 prior_usec, next_usec;
+	char *fn = lp_bwlimit_status_file();
+	int64 now;
+
+	if (!shared || !*fn)
+		return 0;
+
+	now = now_usec();
+	if (now < next_usec)
+		return (int)((next_usec - now + ONE_SEC - 1) / ONE_SEC);
+
+	/* The daemon's own limit is in the globals that it has loaded. */
+	shared->bucket[0].kbps = lp_daemon_bwlimit();
+	write_status_file(fn, prior_usec ? (double)(now - prior_usec) / ONE_SEC : 0);
+	prior_usec = now;
+	next_usec = now + STATUS_SECS * ONE_SEC;
+
+	return STATUS_SECS;
+#else
+	return 0;
+#endif
+}
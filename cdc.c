@@ -0,0 +1,140 @@
+/*
+ * Content-defined chunking for the --cdc delta-transfer mode.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+/*
+ * With --cdc, the generator cuts the basis file into chunks whose ends are
+ * chosen by the data itself (a FastCDC-style cut on a "gear" hash of the
+ * last 32 bytes), and the sender cuts its file the same way.  Data that was
+ * inserted or removed only changes the chunks around it, so the sender can
+ * find the unchanged chunks with one hash lookup per chunk instead of
+ * rolling a checksum over every byte.  The receiver cuts up the basis file
+ * again to find where each matched chunk lives.
+ *
+ * Every side must cut the chunks in exactly the same way, so nothing here
+ * may change without a change to the protocol.
+ */
+
+#include "rsync.h"
+
+static uint32 gear[256];
+
+static void init_gear(void)
+{
+	uint32 x = 0x2545F491;
+	int j;
+
+	/* A fixed xorshift sequence, so that every rsync has the same table. */
+	for (j = 0; j < 256; j++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		gear[j] = x;
+	}
+}
+
+/* Turn the block length that sum_sizes_sqroot() chose into the average
+ * chunk size, which is a power of 2 from CDC_MIN_AVG to CDC_MAX_AVG. */
+int32 cdc_avg_size(int32 blength)
+{
+	int32 avg;
+
+	for (avg = CDC_MIN_AVG; avg < blength && avg < CDC_MAX_AVG; avg <<= 1) {}
+
+	return avg;
+}
+
+/* Return the length of the chunk that starts at offset, where there are
+ * "remaining" bytes left in the file.  The chunk is between avg/4 and
+ * avg*4 bytes long (unless the file ends first).  Up to avg bytes it
+ * takes a harder-to-hit cut, and after that an easier one, which keeps
+ * the chunk sizes bunched up around avg. */
+int32 cdc_chunk_len(struct map_struct *buf, OFF_T offset, OFF_T remaining,
+		    int32 avg)
+{
+	int32 min = avg / 4, max = avg * 4, normal, n, i;
+	uint32 fp = 0, mask_s, mask_l;
+	uchar *p;
+	int bits;
+
+	if (remaining <= min)
+		return (int32)remaining;
+	n = (int32)MIN(remaining, (OFF_T)max);
+	normal = MIN(avg, n);
+
+	if (!gear[0])
+		init_gear();
+
+	for (bits = 0; (1 << bits) < avg; bits++) {}
+	mask_s = ~(uint32)0 << (32 - (bits + 2));
+	mask_l = ~(uint32)0 << (32 - (bits - 2));
+
+	p = (uchar *)map_ptr(buf, offset, n);
+
+	for (i = min; i < normal; i++) {
+		fp = (fp << 1) + gear[p[i]];
+		if (!(fp & mask_s))
+			return i + 1;
+	}
+	for ( ; i < n; i++) {
+		fp = (fp << 1) + gear[p[i]];
+		if (!(fp & mask_l))
+			return i + 1;
+	}
+
+	return n;
+}
+
+/* Find where chunk i of the basis file starts and how long it is, cutting
+ * up the file as far as is needed.  The chunks are found in order and are
+ * remembered in the cdc_index, so a file is only scanned once.  Returns 0
+ * if the file doesn't have a chunk i (i.e. it changed after the generator
+ * looked at it). */
+int cdc_find_chunk(struct cdc_index *ci, struct map_struct *buf, OFF_T size,
+		   int32 avg, int32 i, OFF_T *offset_p, int32 *len_p)
+{
+	OFF_T end;
+
+	if (i < 0)
+		return 0;
+
+	if (!ci->cnt) {
+		if (!ci->alloc) {
+			ci->alloc = 1024;
+			if (!(ci->offsets = new_array(OFF_T, ci->alloc)))
+				out_of_memory("cdc_find_chunk");
+		}
+		ci->offsets[0] = 0;
+	}
+
+	for (end = ci->offsets[ci->cnt]; ci->cnt <= i && end < size; ) {
+		end += cdc_chunk_len(buf, end, size - end, avg);
+		if (ci->cnt + 2 > ci->alloc) {
+			ci->alloc *= 2;
+			if (!(ci->offsets = realloc_array(ci->offsets, OFF_T, ci->alloc)))
+				out_of_memory("cdc_find_chunk");
+		}
+		ci->offsets[++ci->cnt] = end;
+	}
+
+	if (i >= ci->cnt)
+		return 0;
+
+	*offset_p = ci->offsets[i];
+	*len_p = (int32)(ci->offsets[i+1] - ci->offsets[i]);
+
+	return 1;
+}
@@ -23,10 +23,200 @@
 
 extern int checksum_seed;
 extern int protocol_version;
+extern int checksum_len;
+extern char *checksum_choice;
+extern char *rolling_choice;
+
+/* The strong-checksum algorithms, in our order of preference.  The one that
+ * gets used is either the protocol's default (MD4 before protocol 30, MD5
+ * after) or the one that the two sides negotiate.  It is used for the block
+ * checksums, the whole-file checksum that verifies each transfer, and the
+ * --checksum file sums. */
+struct csum_algo {
+	int num;
+	const char *name;
+	int len;
+};
+
+static struct csum_algo csum_algos[] = {
+#ifdef SUPPORT_XXH64
+	{ CSUM_XXH64, "xxh64", XXH64_DIGEST_LEN },
+#endif
+	{ CSUM_MD5, "md5", MD5_DIGEST_LEN },
+	{ CSUM_MD4, "md4", MD4_DIGEST_LEN },
+	{ 0, NULL, 0 }
+};
+
+/* The rolling checksums, which are negotiated along with the strong one.
+ * The Adler-style sum is preferred, so CRC32C (which has fewer false
+ * alarms on highly structured data) is only used when it is asked for. */
+static struct csum_algo rsum_algos[] = {
+	{ RSUM_ADLER, "adler", 4 },
+	{ RSUM_CRC32C, "crc32c", 4 },
+	{ 0, NULL, 0 }
+};
+
+static int negotiated_csum;
+static int rsum_type = RSUM_ADLER;
+
+static struct csum_algo *csum_algo_by_name(struct csum_algo *algos,
+					   const char *name, int len)
+{
+	struct csum_algo *ca;
+
+	for (ca = algos; ca->name; ca++) {
+		if (strncasecmp(name, ca->name, len) == 0 && !ca->name[len])
+			return ca;
+	}
+	return NULL;
+}
+
+/* The space-separated names of the algorithms in the list. */
+static const char *csum_algo_names(struct csum_algo *algos, char *buf, int bufsize)
+{
+	struct csum_algo *ca;
+	int len = 0;
+
+	if (!*buf) {
+		for (ca = algos; ca->name; ca++)
+			len += snprintf(buf + len, bufsize - len, "%s%s", len ? " " : "", ca->name);
+	}
+	return buf;
+}
+
+/* Find the first name in the client's list that is also in the server's
+ * list (so that both sides make the same choice). */
+static struct csum_algo *choose_csum_algo(struct csum_algo *algos,
+					  const char *client_list,
+					  const char *server_list)
+{
+	const char *cp, *sp;
+	int len, slen;
+
+	for (cp = client_list; *cp; cp += len) {
+		cp += strspn(cp, " ");
+		len = strcspn(cp, " ");
+		if (!len)
+			break;
+		for (sp = server_list; *sp; sp += slen) {
+			sp += strspn(sp, " ");
+			slen = strcspn(sp, " ");
+			if (slen == len && strncasecmp(cp, sp, len) == 0)
+				return csum_algo_by_name(algos, cp, len);
+		}
+	}
+
+	return NULL;
+}
+
+/* The algorithm that is in use for this transfer. */
+static int csum_type(void)
+{
+	if (negotiated_csum)
+		return negotiated_csum;
+	return protocol_version >= 30 ? CSUM_MD5 : CSUM_MD4;
+}
+
+int checksum_type(void)
+{
+	return csum_type();
+}
+
+/* Returns 0 if the --checksum-choice name is not one that we support. */
+int valid_checksum_choice(void)
+{
+	return csum_algo_by_name(csum_algos, checksum_choice, strlen(checksum_choice)) != NULL;
+}
+
+/* Returns 0 if the --rolling-choice name is not one that we support. */
+int valid_rolling_choice(void)
+{
+	return csum_algo_by_name(rsum_algos, rolling_choice, strlen(rolling_choice)) != NULL;
+}
+
+/* The space-separated list of checksum names that we offer to the other
+ * side, which is just the --checksum-choice name if one was given. */
+const char *checksum_names(void)
+{
+	static char buf[64];
+
+	if (checksum_choice)
+		return checksum_choice;
+	return csum_algo_names(csum_algos, buf, sizeof buf);
+}
+
+/* The same for the rolling checksums and --rolling-choice. */
+const char *rolling_checksum_names(void)
+{
+	static char buf[64];
+
+	if (rolling_choice)
+		return rolling_choice;
+	return csum_algo_names(rsum_algos, buf, sizeof buf);
+}
+
+/* Pick the strong checksum from the two sides' lists.  Returns 0 if they
+ * have no name in common. */
+int choose_checksum(const char *client_list, const char *server_list)
+{
+	struct csum_algo *ca = choose_csum_algo(csum_algos, client_list, server_list);
+
+	if (!ca)
+		return 0;
+	negotiated_csum = ca->num;
+	checksum_len = ca->len;
+	return 1;
+}
+
+/* Pick the rolling checksum from the two sides' lists.  Returns 0 if they
+ * have no name in common. */
+int choose_rolling_checksum(const char *client_list, const char *server_list)
+{
+	struct csum_algo *ca = choose_csum_algo(rsum_algos, client_list, server_list);
+
+	if (!ca)
+		return 0;
+	if ((rsum_type = ca->num) == RSUM_CRC32C)
+		crc32c_init();
+	return 1;
+}
+
+/* The name of the checksum that is in use (for messages). */
+const char *checksum_name(void)
+{
+	struct csum_algo *ca;
+	int num = csum_type();
+
+	for (ca = csum_algos; ca->name; ca++) {
+		if (ca->num == num)
+			return ca->name;
+	}
+	return "?";
+}
+
+/* The name of the rolling checksum that is in use (for messages). */
+const char *rolling_checksum_name(void)
+{
+	return rsum_type == RSUM_CRC32C ? "crc32c" : "adler";
+}
+
+/* Which rolling checksum get_checksum1() computes (RSUM_ADLER or
+ * RSUM_CRC32C), which tells match.c how to roll it. */
+int rolling_checksum_type(void)
+{
+	return rsum_type;
+}
+
+/* The length of the strong checksum that is in use. */
+int checksum_digest_len(void)
+{
+	return csum_type() == CSUM_XXH64 ? XXH64_DIGEST_LEN : MD5_DIGEST_LEN;
+}
 
 /*
   a simple 32 bit checksum that can be upadted from either end
-  (inspired by Mark Adler's Adler-32 checksum)
+  (inspired by Mark Adler's Adler-32 checksum), or a CRC32C if that
+  was negotiated
   */
 uint32 get_checksum1(char *buf1, int32 len)
 {
@@ -34,8 +224,16 @@ uint32 get_checksum1(char *buf1, int32 len)
     uint32 s1, s2;
     schar *buf = (schar *)buf1;
 
+    if (rsum_type == RSUM_CRC32C)
+	return crc32c_update(0, (uchar *)buf1, len);
+
     s1 = s2 = 0;
-    for (i = 0; i < (len-4); i+=4) {
+#ifdef USE_SIMD_CHECKSUM
+    i = get_checksum1_simd(buf, len, &s1, &s2);
+#else
+    i = 0;
+#endif
+    for (; i < (len-4); i+=4) {
 	s2 += 4*(s1 + buf[i]) + 3*buf[i+1] + 2*buf[i+2] + buf[i+3] +
 	  10*CHAR_OFFSET;
 	s1 += (buf[i+0] + buf[i+1] + buf[i+2] + buf[i+3] + 4*CHAR_OFFSET);
@@ -51,7 +249,13 @@ void get_checksum2(char *buf, int32 len, char *sum)
 {
 	md_context m;
 
-	if (protocol_version >= 30) {
+	switch (csum_type()) {
+#ifdef SUPPORT_XXH64
+	case CSUM_XXH64:
+		get_xxh64((uchar *)sum, (uchar *)buf, len, checksum_seed);
+		break;
+#endif
+	case CSUM_MD5: {
 		uchar seedbuf[4];
 		md5_begin(&m);
 		md5_update(&m, (uchar *)buf, len);
@@ -60,30 +264,31 @@ void get_checksum2(char *buf, int32 len, char *sum)
 			md5_update(&m, seedbuf, 4);
 		}
 		md5_result(&m, (uchar *)sum);
-	} else {
-		int32 i;
-		static char *buf1;
-		static int32 len1;
+		break;
+	  }
+	case CSUM_MD4: {
+		uchar tail[CSUM_CHUNK + 4];
+		int32 i, tlen;
 
 		mdfour_begin(&m);
 
-		if (len > len1) {
-			if (buf1)
-				free(buf1);
-			buf1 = new_array(char, len+4);
-			len1 = len;
-			if (!buf1)
-				out_of_memory("get_checksum2");
-		}
+		for (i = 0; i + CSUM_CHUNK <= len; i += CSUM_CHUNK)
+			mdfour_update(&m, (uchar *)(buf+i), CSUM_CHUNK);
 
-		memcpy(buf1, buf, len);
+		/* Only the last partial chunk needs to be copied in order
+		 * to append the seed to it. */
+		tlen = len - i;
+		memcpy(tail, buf+i, tlen);
 		if (checksum_seed) {
-			SIVAL(buf1,len,checksum_seed);
-			len += 4;
+			SIVAL(tail,tlen,checksum_seed);
+			tlen += 4;
 		}
 
-		for (i = 0; i + CSUM_CHUNK <= len; i += CSUM_CHUNK)
-			mdfour_update(&m, (uchar *)(buf1+i), CSUM_CHUNK);
+		i = 0;
+		if (tlen >= CSUM_CHUNK) {
+			mdfour_update(&m, tail, CSUM_CHUNK);
+			i = CSUM_CHUNK;
+		}
 
 		/*
 		 * Prior to version 27 an incorrect MD4 checksum was computed
@@ -91,18 +296,55 @@ void get_checksum2(char *buf, int32 len, char *sum)
 		 * are multiples of 64.  This is fixed by calling mdfour_update()
 		 * even when there are no more bytes.
 		 */
-		if (len - i > 0 || protocol_version >= 27)
-			mdfour_update(&m, (uchar *)(buf1+i), len-i);
+		if (tlen - i > 0 || protocol_version >= 27)
+			mdfour_update(&m, tail+i, tlen-i);
 
 		mdfour_result(&m, (uchar *)sum);
+		break;
+	  }
+	}
+}
+
+/* Compute the strong checksums of cnt (<= CSUM2_LANES) blocks that are all
+ * len bytes long.  The SIMD code hashes all the blocks in parallel when it
+ * can handle the negotiated protocol's checksum. */
+void get_checksum2_multi(char **bufs, int32 len, int cnt, char **sums)
+{
+#ifdef USE_SIMD_CHECKSUM
+	int type = csum_type();
+
+	if (cnt > 1 && protocol_version >= 27 && (type == CSUM_MD5 || type == CSUM_MD4)) {
+		char *lane_bufs[CSUM2_LANES], *lane_sums[CSUM2_LANES];
+		char dummy_sum[CSUM2_LANES][MAX_DIGEST_LEN];
+		uchar seedbuf[4];
+		int j;
+
+		for (j = 0; j < CSUM2_LANES; j++) {
+			lane_bufs[j] = bufs[j < cnt ? j : 0];
+			lane_sums[j] = j < cnt ? sums[j] : dummy_sum[j];
+		}
+		if (checksum_seed)
+			SIVALu(seedbuf, 0, checksum_seed);
+		md_lanes_sse2(type == CSUM_MD5, lane_bufs, len,
+			      seedbuf, checksum_seed ? 4 : 0, lane_sums);
+		return;
 	}
+#endif
+
+	while (cnt-- > 0)
+		get_checksum2(*bufs++, len, *sums++);
 }
 
-void file_checksum(char *fname, char *sum, OFF_T size)
+/* Compute the whole-file checksum of fname.  Returns 0 if the file couldn't
+ * be read (which leaves a sum that matches nothing useful). */
+int file_checksum(char *fname, char *sum, OFF_T size)
 {
 	struct map_struct *buf;
 	OFF_T i, len = size;
 	md_context m;
+#ifdef SUPPORT_XXH64
+	xxh64_context xm;
+#endif
 	int32 remainder;
 	int fd;
 
@@ -110,11 +352,28 @@ void file_checksum(char *fname, char *sum, OFF_T size)
 
 	fd = do_open(fname, O_RDONLY, 0);
 	if (fd == -1)
-		return;
+		return 0;
 
 	buf = map_file(fd, size, MAX_MAP_SIZE, CSUM_CHUNK);
 
-	if (protocol_version >= 30) {
+	switch (csum_type()) {
+#ifdef SUPPORT_XXH64
+	case CSUM_XXH64:
+		xxh64_begin(&xm, 0);
+
+		for (i = 0; i + CHUNK_SIZE <= len; i += CHUNK_SIZE) {
+			xxh64_update(&xm, (uchar *)map_ptr(buf, i, CHUNK_SIZE),
+				     CHUNK_SIZE);
+		}
+
+		remainder = (int32)(len - i);
+		if (remainder > 0)
+			xxh64_update(&xm, (uchar *)map_ptr(buf, i, remainder), remainder);
+
+		xxh64_result(&xm, (uchar *)sum);
+		break;
+#endif
+	case CSUM_MD5:
 		md5_begin(&m);
 
 		for (i = 0; i + CSUM_CHUNK <= len; i += CSUM_CHUNK) {
@@ -127,7 +386,8 @@ void file_checksum(char *fname, char *sum, OFF_T size)
 			md5_update(&m, (uchar *)map_ptr(buf, i, remainder), remainder);
 
 		md5_result(&m, (uchar *)sum);
-	} else {
+		break;
+	case CSUM_MD4:
 		mdfour_begin(&m);
 
 		for (i = 0; i + CSUM_CHUNK <= len; i += CSUM_CHUNK) {
@@ -144,26 +404,39 @@ void file_checksum(char *fname, char *sum, OFF_T size)
 			mdfour_update(&m, (uchar *)map_ptr(buf, i, remainder), remainder);
 
 		mdfour_result(&m, (uchar *)sum);
+		break;
 	}
 
 	close(fd);
-	unmap_file(buf);
+	return unmap_file(buf) == 0;
 }
 
 static int32 sumresidue;
 static md_context md;
+#ifdef SUPPORT_XXH64
+static xxh64_context xxh64_md;
+#endif
+static int sum_type;
 
 void sum_init(int seed)
 {
 	char s[4];
 
-	if (protocol_version >= 30)
+	switch (sum_type = csum_type()) {
+#ifdef SUPPORT_XXH64
+	case CSUM_XXH64:
+		xxh64_begin(&xxh64_md, 0);
+		break;
+#endif
+	case CSUM_MD5:
 		md5_begin(&md);
-	else {
+		break;
+	case CSUM_MD4:
 		mdfour_begin(&md);
 		sumresidue = 0;
 		SIVAL(s, 0, seed);
 		sum_update(s, 4);
+		break;
 	}
 }
 
@@ -177,7 +450,13 @@ void sum_init(int seed)
  **/
 void sum_update(const char *p, int32 len)
 {
-	if (protocol_version >= 30) {
+	switch (sum_type) {
+#ifdef SUPPORT_XXH64
+	case CSUM_XXH64:
+		xxh64_update(&xxh64_md, (uchar *)p, len);
+		return;
+#endif
+	case CSUM_MD5:
 		md5_update(&md, (uchar *)p, len);
 		return;
 	}
@@ -209,7 +488,13 @@ void sum_update(const char *p, int32 len)
 
 int sum_end(char *sum)
 {
-	if (protocol_version >= 30) {
+	switch (sum_type) {
+#ifdef SUPPORT_XXH64
+	case CSUM_XXH64:
+		xxh64_result(&xxh64_md, (uchar *)sum);
+		return XXH64_DIGEST_LEN;
+#endif
+	case CSUM_MD5:
 		md5_result(&md, (uchar *)sum);
 		return MD5_DIGEST_LEN;
 	}
@@ -0,0 +1,495 @@
+/*
+ * Test suite for the optimized checksum routines.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+#include "rsync.h"
+
+#define TEST_BUF_SIZE (MAX_BLOCK_SIZE + 64)
+#define TEST_ITERATIONS 2000
+
+int protocol_version = PROTOCOL_VERSION;
+
+static int checksum_errors = 0;
+
+/* The plain byte-at-a-time form of get_checksum1(). */
+static uint32 ref_checksum1(schar *buf, int32 len)
+{
+	uint32 s1 = 0, s2 = 0;
+	int32 i;
+
+	for (i = 0; i < len; i++) {
+		s1 += buf[i] + CHAR_OFFSET;
+		s2 += s1;
+	}
+	return (s1 & 0xffff) + (s2 << 16);
+}
+
+#ifdef USE_SIMD_CHECKSUM
+static uint32 simd_checksum1(schar *buf, int32 len)
+{
+	uint32 s1 = 0, s2 = 0;
+	int32 i;
+
+	for (i = get_checksum1_simd(buf, len, &s1, &s2); i < len; i++) {
+		s1 += buf[i] + CHAR_OFFSET;
+		s2 += s1;
+	}
+	return (s1 & 0xffff) + (s2 << 16);
+}
+
+static void test_checksum1(const char *name, schar *buf)
+{
+	int j;
+
+	if (!set_simd_checksum1(name)) {
+		printf("Skipping the %s checksum1 kernel (unsupported CPU).\n", name);
+		return;
+	}
+
+	for (j = 0; j < TEST_ITERATIONS; j++) {
+		int32 off = random() % 64;
+		int32 len;
+		uint32 want, got;
+
+		switch (j % 4) {
+		case 0:
+			len = random() % 256;
+			break;
+		case 1:
+			len = BLOCK_SIZE + random() % 64;
+			break;
+		default:
+			len = random() % (TEST_BUF_SIZE - 64);
+			break;
+		}
+
+		want = ref_checksum1(buf + off, len);
+		got = simd_checksum1(buf + off, len);
+		if (got != want) {
+			printf("%s checksum1 mismatch: off=%ld len=%ld got=%08lx want=%08lx\n",
+			       name, (long)off, (long)len,
+			       (unsigned long)got, (unsigned long)want);
+			checksum_errors++;
+		}
+	}
+}
+
+/* Hash a buffer plus seed the way get_checksum2() does (for protocol 27+). */
+static void ref_checksum2(int use_md5, char *buf, int32 len, uchar *seedbuf,
+			  int seedlen, char *sum)
+{
+	md_context m;
+
+	if (use_md5) {
+		md5_begin(&m);
+		md5_update(&m, (uchar *)buf, len);
+		md5_update(&m, seedbuf, seedlen);
+		md5_result(&m, (uchar *)sum);
+	} else {
+		char *buf1 = malloc(len + seedlen);
+		int32 i;
+
+		memcpy(buf1, buf, len);
+		memcpy(buf1 + len, seedbuf, seedlen);
+		len += seedlen;
+
+		mdfour_begin(&m);
+		for (i = 0; i + CSUM_CHUNK <= len; i += CSUM_CHUNK)
+			mdfour_update(&m, (uchar *)buf1 + i, CSUM_CHUNK);
+		mdfour_update(&m, (uchar *)buf1 + i, len - i);
+		mdfour_result(&m, (uchar *)sum);
+		free(buf1);
+	}
+}
+
+static void test_checksum2_lanes(int use_md5, schar *buf)
+{
+	const char *name = use_md5 ? "md5" : "md4";
+	char sumbuf[CSUM2_LANES][MAX_DIGEST_LEN], want[MAX_DIGEST_LEN];
+	char *bufs[CSUM2_LANES], *sums[CSUM2_LANES];
+	uchar seedbuf[4];
+	int j, k;
+
+	for (j = 0; j < TEST_ITERATIONS / 4; j++) {
+		int32 len = j < 200 ? j : random() % (MAX_BLOCK_SIZE / 2);
+		int seedlen = j % 2 ? 4 : 0;
+
+		SIVALu(seedbuf, 0, (uint32)random());
+		for (k = 0; k < CSUM2_LANES; k++) {
+			bufs[k] = (char *)buf + random() % (TEST_BUF_SIZE - len);
+			sums[k] = sumbuf[k];
+		}
+
+		md_lanes_sse2(use_md5, bufs, len, seedbuf, seedlen, sums);
+
+		for (k = 0; k < CSUM2_LANES; k++) {
+			ref_checksum2(use_md5, bufs[k], len, seedbuf, seedlen, want);
+			if (memcmp(sums[k], want, MAX_DIGEST_LEN) != 0) {
+				printf("%s lane %d mismatch: len=%ld seedlen=%d\n",
+				       name, k, (long)len, seedlen);
+				checksum_errors++;
+			}
+		}
+	}
+}
+#endif
+
+#ifdef SUPPORT_XXH64
+/* Check XXH64 against some published results (the digest is stored as a
+ * little-endian 64-bit number), and check that a digest built up from many
+ * small updates matches the one-shot result. */
+static void test_xxh64(schar *buf)
+{
+	static const struct {
+		int len, fill;
+		uint64 seed, want;
+	} vecs[] = {
+		{ 0, 0, 0, 0xef46db3751d8e999ULL },
+		{ 3, 0, 0, 0x44bc2cf5ad770999ULL },
+		{ 3, 0, 1, 0xbea9ca8199328908ULL },
+		{ 45, 1, 0, 0x10fdd84d6409abdfULL },
+		{ 45, 1, 7, 0xe4ed0032f0c9066aULL },
+		{ 768, 1, 0, 0x8e03c838c596036fULL },
+		{ 768, 1, 0x12345678, 0xc90687d42610a848ULL },
+	};
+	uchar data[768], digest[XXH64_DIGEST_LEN], want[XXH64_DIGEST_LEN];
+	xxh64_context ctx;
+	int j, k;
+
+	for (j = 0; j < (int)(sizeof vecs / sizeof vecs[0]); j++) {
+		uint64 got;
+		if (vecs[j].fill) {
+			for (k = 0; k < vecs[j].len; k++)
+				data[k] = k & 0xff;
+		} else
+			memcpy(data, "abc", 3);
+		get_xxh64(digest, data, vecs[j].len, vecs[j].seed);
+		got = (uint64)IVALu(digest, 0) | ((uint64)IVALu(digest, 4) << 32);
+		if (got != vecs[j].want) {
+			printf("xxh64 mismatch: len=%d seed=%lx\n",
+			       vecs[j].len, (unsigned long)vecs[j].seed);
+			checksum_errors++;
+		}
+	}
+
+	for (j = 0; j < TEST_ITERATIONS / 4; j++) {
+		int32 len = j < 200 ? j : random() % (MAX_BLOCK_SIZE / 2);
+		int32 off = random() % 64, pos, step;
+
+		get_xxh64(want, (uchar *)buf + off, len, j);
+
+		xxh64_begin(&ctx, j);
+		for (pos = 0; pos < len; pos += step) {
+			step = 1 + random() % 70;
+			if (step > len - pos)
+				step = len - pos;
+			xxh64_update(&ctx, (uchar *)buf + off + pos, step);
+		}
+		xxh64_result(&ctx, digest);
+
+		if (memcmp(digest, want, XXH64_DIGEST_LEN) != 0) {
+			printf("xxh64 split-update mismatch: len=%ld\n", (long)len);
+			checksum_errors++;
+		}
+	}
+}
+#endif
+
+/* The plain table-driven form of crc32c_update(). */
+static uint32 ref_crc32c(uint32 crc, const uchar *buf, int32 len)
+{
+	int32 i;
+
+	for (i = 0; i < len; i++)
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ buf[i]) & 0xFF];
+	return crc;
+}
+
+/* Check CRC32C against the standard check value, check the SSE4.2 code
+ * against the table code, and check that rolling a window along a buffer
+ * gives the same CRC as computing it from scratch. */
+static void test_crc32c(schar *buf)
+{
+	static const int32 windows[] = { 1, 7, 700, BLOCK_SIZE * 3 + 5, MAX_BLOCK_SIZE };
+	uchar *ubuf = (uchar *)buf;
+	uint32 crc, want;
+	int32 pos, len;
+	int j;
+
+	crc32c_init();
+
+	crc = crc32c_update(0xFFFFFFFF, (const uchar *)"123456789", 9) ^ 0xFFFFFFFF;
+	if (crc != 0xE3069283) {
+		printf("crc32c check value mismatch: got=%08lx\n", (unsigned long)crc);
+		checksum_errors++;
+	}
+
+#ifdef USE_SIMD_CHECKSUM
+	crc = 0;
+	if (!get_crc32c_simd(&crc, ubuf, 1))
+		printf("Skipping the sse4.2 crc32c kernel (unsupported CPU).\n");
+	else {
+		for (j = 0; j < TEST_ITERATIONS; j++) {
+			int32 off = random() % 64;
+			len = j < 200 ? j : random() % (TEST_BUF_SIZE - 64);
+			crc = want = (uint32)random();
+			get_crc32c_simd(&crc, ubuf + off, len);
+			want = ref_crc32c(want, ubuf + off, len);
+			if (crc != want) {
+				printf("sse4.2 crc32c mismatch: off=%ld len=%ld\n",
+				       (long)off, (long)len);
+				checksum_errors++;
+			}
+		}
+	}
+#endif
+
+	for (j = 0; j < (int)(sizeof windows / sizeof windows[0]); j++) {
+		int32 start = 0, stop;
+		len = windows[j];
+		crc32c_roll_init(len);
+		/* Roll along the start of the buffer, then along its end. */
+		while (1) {
+			stop = MIN(start + 300, TEST_BUF_SIZE - len);
+			crc = crc32c_update(0, ubuf + start, len);
+			for (pos = start; pos < stop; pos++) {
+				crc = CRC32C_ROLL(crc, ubuf[pos], ubuf[pos + len]);
+				if (crc != (want = ref_crc32c(0, ubuf + pos + 1, len))) {
+					printf("crc32c rolling mismatch: window=%ld pos=%ld\n",
+					       (long)len, (long)pos);
+					checksum_errors++;
+					break;
+				}
+			}
+			if (stop == TEST_BUF_SIZE - len)
+				break;
+			start = MAX(stop, TEST_BUF_SIZE - len - 300);
+		}
+	}
+}
+
+/* Fill len bytes of buf with data that has runs of zeros in it: the runs
+ * are up to max_zeros long, and the data between them is up to max_data
+ * bytes (which have the odd zero in them too). */
+static void fill_zero_runs(char *buf, int32 len, int32 max_zeros, int32 max_data)
+{
+	int32 pos = 0, n;
+
+	while (pos < len) {
+		n = 1 + random() % max_zeros;
+		n = MIN(n, len - pos);
+		memset(buf + pos, 0, n);
+		pos += n;
+		n = 1 + random() % max_data;
+		for (n = MIN(n, len - pos); n > 0; n--, pos++)
+			buf[pos] = (char)(random() % 50 ? 1 + random() % 255 : 0);
+	}
+}
+
+/* The plain byte-at-a-time forms of count_zeros() and find_zero_run(). */
+static int32 ref_count_zeros(const char *buf, int32 len)
+{
+	int32 i;
+
+	for (i = 0; i < len && !buf[i]; i++) {}
+	return i;
+}
+
+static int32 ref_find_zero_run(const char *buf, int32 len, int32 min_run)
+{
+	int32 i, j;
+
+	for (i = 0; i < len; i = j) {
+		if (buf[i]) {
+			j = i + 1;
+			continue;
+		}
+		for (j = i; j < len && !buf[j]; j++) {}
+		if (j == len || j - i >= min_run)
+			return i;
+	}
+	return len;
+}
+
+static void test_zeros(const char *name)
+{
+	static const int32 min_runs[] = { 2, 3, 64, 1000, 1024, 4096, 65536 };
+	char *buf = malloc(TEST_BUF_SIZE);
+	int j;
+
+#ifdef USE_SIMD_CHECKSUM
+	if (!set_simd_zeros(name)) {
+		printf("Skipping the %s zero-scan kernel (unsupported CPU).\n", name);
+		free(buf);
+		return;
+	}
+#endif
+
+	for (j = 0; j < TEST_ITERATIONS; j++) {
+		int32 off = random() % 64, len, min_run, want, got;
+
+		if (j % 100 == 0)
+			fill_zero_runs(buf, TEST_BUF_SIZE, j % 200 ? 3000 : 70000, 2000);
+		len = j < 200 ? j : random() % (TEST_BUF_SIZE - 64);
+		min_run = min_runs[j % (sizeof min_runs / sizeof min_runs[0])];
+
+		want = ref_count_zeros(buf + off, len);
+		if ((got = count_zeros(buf + off, len)) != want) {
+			printf("%s count_zeros mismatch: off=%ld len=%ld got=%ld want=%ld\n",
+			       name, (long)off, (long)len, (long)got, (long)want);
+			checksum_errors++;
+		}
+
+		want = ref_find_zero_run(buf + off, len, min_run);
+		if ((got = find_zero_run(buf + off, len, min_run)) != want) {
+			printf("%s find_zero_run mismatch: off=%ld len=%ld min=%ld got=%ld want=%ld\n",
+			       name, (long)off, (long)len, (long)min_run, (long)got, (long)want);
+			checksum_errors++;
+		}
+	}
+
+	free(buf);
+}
+
+/* Scan buf the way write_sparse() does, returning how many holes it found
+ * (so that the compiler can't skip the work). */
+static int32 sparse_scan(const char *buf, int32 len, int32 min_run)
+{
+	int32 pos, run, holes = 0;
+
+	for (pos = 0; pos < len; pos += run) {
+		if ((run = count_zeros(buf + pos, len - pos)) > 0)
+			holes++;
+		else
+			run = find_zero_run(buf + pos, len - pos, min_run);
+	}
+	return holes;
+}
+
+/* The 1KB-at-a-time byte scan that write_sparse() used to do. */
+static int32 old_sparse_scan(const char *buf, int32 len, UNUSED(int32 min_run))
+{
+	int32 pos, l1, l2, n, holes = 0;
+
+	for (pos = 0; pos < len; pos += n) {
+		n = MIN(len - pos, 1024);
+		for (l1 = 0; l1 < n && buf[pos+l1] == 0; l1++) {}
+		for (l2 = 0; l2 < n-l1 && buf[pos+n-(l2+1)] == 0; l2++) {}
+		holes += l1 > 0;
+	}
+	return holes;
+}
+
+#define BENCH_BUF_SIZE (64*1024*1024)
+
+/* Report how fast each zero scan gets through zero-heavy data (like a disk
+ * image) and through mixed data (like a binary). */
+static void bench_zeros(void)
+{
+	static const char *kernels[] = { "old", "none", "sse2", "avx2", NULL };
+	char *buf = malloc(BENCH_BUF_SIZE);
+	int32 holes = 0;
+	int data, j, k;
+
+	if (!buf)
+		return;
+
+	printf("%-8s %-12s %10s\n", "kernel", "data", "GB/sec");
+	for (data = 0; data < 2; data++) {
+		if (data == 0)
+			fill_zero_runs(buf, BENCH_BUF_SIZE, 1024 * 1024, 4096);
+		else
+			fill_zero_runs(buf, BENCH_BUF_SIZE, 200, 2000);
+		for (j = 0; kernels[j]; j++) {
+			struct timeval start, end;
+			double secs;
+			if (j > 1) {
+#ifdef USE_SIMD_CHECKSUM
+				if (!set_simd_zeros(kernels[j]))
+#endif
+					continue;
+			}
+#ifdef USE_SIMD_CHECKSUM
+			else if (j == 1)
+				set_simd_zeros("none");
+#endif
+			gettimeofday(&start, NULL);
+			for (k = 0; k < 8; k++) {
+				holes += j ? sparse_scan(buf, BENCH_BUF_SIZE, 4096)
+					   : old_sparse_scan(buf, BENCH_BUF_SIZE, 4096);
+			}
+			gettimeofday(&end, NULL);
+			secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+			printf("%-8s %-12s %10.2f\n", kernels[j], data ? "mixed" : "zero-heavy",
+			       8.0 * BENCH_BUF_SIZE / (secs * 1e9));
+		}
+	}
+	if (!holes)
+		printf("(no holes found)\n");
+
+	free(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	schar *buf;
+	int32 i;
+
+	if (!(buf = (schar *)malloc(TEST_BUF_SIZE)))
+		return 1;
+
+	srandom(0x5eed);
+	for (i = 0; i < TEST_BUF_SIZE; i++)
+		buf[i] = (schar)random();
+
+#ifdef USE_SIMD_CHECKSUM
+	/* Saturate a run of bytes at both extremes to catch overflows. */
+	memset(buf + 1024, 0x7f, 4096);
+	memset(buf + 8192, 0x80, 4096);
+
+	test_checksum1("sse2", buf);
+	test_checksum1("ssse3", buf);
+	test_checksum1("avx2", buf);
+
+	test_checksum2_lanes(1, buf);
+	test_checksum2_lanes(0, buf);
+#endif
+
+#ifdef SUPPORT_XXH64
+	test_xxh64(buf);
+#endif
+
+	test_crc32c(buf);
+
+#ifdef USE_SIMD_CHECKSUM
+	test_zeros("avx2");
+	test_zeros("sse2");
+	test_zeros("none");
+#else
+	test_zeros("word");
+#endif
+
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+		bench_zeros();
+
+	if (checksum_errors) {
+		printf("-> %d checksum errors found.\n", checksum_errors);
+		return 1;
+	}
+	printf("No checksum errors found.\n");
+	return 0;
+}
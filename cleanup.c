@@ -152,6 +152,7 @@ NORETURN void _exit_cleanup(int code, const char *file, int line)
 				close(cleanup_fd_r);
 			if (cleanup_fd_w != -1) {
 				flush_write_file(cleanup_fd_w);
+				end_write_file(cleanup_fd_w);
 				close(cleanup_fd_w);
 			}
 			finish_transfer(cleanup_new_fname, fname, NULL, NULL,
@@ -43,6 +43,8 @@ extern int filesfrom_fd;
 extern int remote_protocol;
 extern int protocol_version;
 extern int io_timeout;
+extern int daemon_bwlimit;
+extern int daemon_bwlimit_burst;
 extern int no_detach;
 extern int write_batch;
 extern int default_af_hint;
@@ -76,6 +78,7 @@ unsigned int module_dirlen = 0;
 char *full_module_path;
 
 static int rl_nulls = 0;
+static int config_loaded = 0;
 
 #ifdef HAVE_SIGACTION
 static struct sigaction sigact;
@@ -748,6 +751,14 @@ static int rsync_module(int f_in, int f_out, int i, char *addr, char *host)
 		}
 	}
 
+	if (lp_bwlimit(i) && (!daemon_bwlimit || lp_bwlimit(i) < daemon_bwlimit))
+		daemon_bwlimit = lp_bwlimit(i);
+	if (lp_bwlimit_burst(i) > 0) {
+		daemon_bwlimit_burst = lp_bwlimit_burst(i) < MAX_BWLIMIT_BURST / 1024
+				     ? lp_bwlimit_burst(i) * 1024 : MAX_BWLIMIT_BURST;
+	}
+	bwlimit_shared_join(name, lp_module_bwlimit(i), lp_daemon_bwlimit());
+
 	io_printf(f_out, "@RSYNCD: OK\n");
 
 	read_args(f_in, name, line, sizeof line, rl_nulls, &argv, &argc, &request);
@@ -911,6 +922,31 @@ static int load_config(int globals_only)
 	return lp_load(config_file, globals_only);
 }
 
+/* A pool worker loads the whole config file once, and the sessions that
+ * it forks use it as is.  Once the file changes, this returns 0 so that
+ * the worker gets replaced by one that loads the new config. */
+static int worker_config_ok(void)
+{
+	static STRUCT_STAT loaded_st;
+	STRUCT_STAT st;
+
+	if (do_stat(config_file, &st) < 0)
+		memset(&st, 0, sizeof st);
+
+	if (!config_loaded) {
+		/* If this fails, each session will try again and report it. */
+		config_loaded = load_config(0);
+		loaded_st = st;
+		return 1;
+	}
+
+	return st.st_mtime == loaded_st.st_mtime
+	    && st.st_ctime == loaded_st.st_ctime
+	    && st.st_size == loaded_st.st_size
+	    && st.st_ino == loaded_st.st_ino
+	    && st.st_dev == loaded_st.st_dev;
+}
+
 /* this is called when a connection is established to a client
    and we want to start talking. The setup of the system is done from
    here */
@@ -925,8 +961,9 @@ int start_daemon(int f_in, int f_out)
 	/* We must load the config file before calling any function that
 	 * might cause log-file output to occur.  This ensures that the
 	 * "log file" param gets honored for the 2 non-forked use-cases
-	 * (when rsync is run by init and run by a remote shell). */
-	if (!load_config(0))
+	 * (when rsync is run by init and run by a remote shell).  A pool
+	 * worker has already loaded it for us (unless it just changed). */
+	if ((!config_loaded || !worker_config_ok()) && !load_config(0))
 		exit_cleanup(RERR_SYNTAX);
 
 	addr = client_addr(f_in);
@@ -1065,12 +1102,20 @@ int daemon_main(void)
 
 	log_init(0);
 
+	/* This must be shared with every connection that we fork. */
+	bwlimit_shared_init();
+
 	rprintf(FLOG, "rsyncd version %s starting, listening on port %d\n",
 		RSYNC_VERSION, rsync_port);
 	/* TODO: If listening on a particular address, then show that
 	 * address too.  In fact, why not just do inet_ntop on the
 	 * local address??? */
 
-	start_accept_loop(rsync_port, start_daemon);
+	if (lp_prefork_workers() > 0) {
+		start_worker_pool(rsync_port, lp_prefork_workers(),
+				  lp_prefork_sessions(), start_daemon,
+				  worker_config_ok);
+	} else
+		start_accept_loop(rsync_port, start_daemon);
 	return -1;
 }
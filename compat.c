@@ -40,6 +40,7 @@ extern int fuzzy_basis;
 extern int read_batch;
 extern int delay_updates;
 extern int checksum_seed;
+extern int write_batch;
 extern int basis_dir_cnt;
 extern int prune_empty_dirs;
 extern int protocol_version;
@@ -54,6 +55,8 @@ extern char *shell_cmd;
 extern char *partial_dir;
 extern char *dest_option;
 extern char *files_from;
+extern char *checksum_choice;
+extern char *rolling_choice;
 extern char *filesfrom_host;
 extern struct filter_list_struct filter_list;
 extern int need_unsorted_flist;
@@ -76,6 +79,7 @@ int filesfrom_convert = 0;
 #define CF_SYMLINK_TIMES (1<<1)
 #define CF_SYMLINK_ICONV (1<<2)
 #define CF_SAFE_FLIST	 (1<<3)
+#define CF_CHKSUM_NEGO	 (1<<4)
 
 static const char *client_info;
 
@@ -115,6 +119,78 @@ static void check_sub_protocol(void)
 		protocol_version--;
 }
 
+/* Each side picks the first of the client's names that the server also
+ * has, or gives up if there isn't one. */
+static void choose_names(const char *what, const char *client_list,
+			 const char *server_list,
+			 int (*choose)(const char *, const char *))
+{
+	if (!choose(client_list, server_list)) {
+		rprintf(FERROR,
+		    "No common %s: the client offered \"%s\" and the server has \"%s\".\n",
+		    what, client_list, server_list);
+		exit_cleanup(RERR_UNSUPPORTED);
+	}
+}
+
+/* The server sends its lists of names for the strong checksum and the
+ * rolling checksum, then the client sends its lists, so that each side's
+ * lists go out together. */
+static void negotiate_checksum(int f_in, int f_out)
+{
+	const char *our_lists[2];
+	char their_lists[2][MAX_NSTR_LEN];
+	int j;
+
+	our_lists[0] = checksum_names();
+	our_lists[1] = rolling_checksum_names();
+
+	if (am_server) {
+		for (j = 0; j < 2; j++)
+			write_vstring(f_out, our_lists[j], strlen(our_lists[j]));
+	}
+	for (j = 0; j < 2; j++)
+		read_vstring(f_in, their_lists[j], MAX_NSTR_LEN);
+	if (!am_server) {
+		for (j = 0; j < 2; j++)
+			write_vstring(f_out, our_lists[j], strlen(our_lists[j]));
+	}
+
+	if (am_server) {
+		choose_names("checksum", their_lists[0], our_lists[0],
+			     choose_checksum);
+		choose_names("rolling checksum", their_lists[1], our_lists[1],
+			     choose_rolling_checksum);
+	} else {
+		choose_names("checksum", our_lists[0], their_lists[0],
+			     choose_checksum);
+		choose_names("rolling checksum", our_lists[1], their_lists[1],
+			     choose_rolling_checksum);
+	}
+
+	if (verbose > 2 && !am_server) {
+		rprintf(FINFO, "Checksum negotiated: %s\n", checksum_name());
+		rprintf(FINFO, "Rolling checksum negotiated: %s\n",
+			rolling_checksum_name());
+	}
+}
+
+/* Complain if a --checksum-choice or --rolling-choice name can't be used
+ * because the checksums weren't negotiated. */
+static void check_unnegotiated_choice(const char *opt, const char *choice,
+				      const char *name)
+{
+	if (!choice || strcasecmp(choice, name) == 0)
+		return;
+
+	rprintf(FERROR,
+	    "--%s=%s cannot be negotiated %s.\n",
+	    opt, choice, read_batch || write_batch ? "with a batch file"
+	    : protocol_version < 30 ? "before protocol 30"
+	    : "with the remote rsync");
+	exit_cleanup(RERR_UNSUPPORTED);
+}
+
 void set_allow_inc_recurse(void)
 {
 	client_info = shell_cmd ? shell_cmd : "";
@@ -132,6 +208,10 @@ void set_allow_inc_recurse(void)
 
 void setup_protocol(int f_out,int f_in)
 {
+	/* Our writes get buffered until we need to read the reply (or are
+	 * done), so that they don't go out as a string of tiny packets. */
+	int buffering = io_start_buffering_out(f_out);
+
 	if (am_sender)
 		file_extra_cnt += PTR_EXTRA_CNT;
 	else
@@ -259,6 +339,8 @@ void setup_protocol(int f_out,int f_in)
 #endif
 			if (local_server || strchr(client_info, 'f') != NULL)
 				compat_flags |= CF_SAFE_FLIST;
+			if (local_server ? !write_batch : strchr(client_info, 'C') != NULL)
+				compat_flags |= CF_CHKSUM_NEGO;
 			write_byte(f_out, compat_flags);
 		} else
 			compat_flags = read_byte(f_in);
@@ -287,12 +369,21 @@ void setup_protocol(int f_out,int f_in)
 		}
 		use_safe_inc_flist = !!(compat_flags & CF_SAFE_FLIST);
 		need_messages_from_generator = 1;
+		if (compat_flags & CF_CHKSUM_NEGO)
+			negotiate_checksum(f_in, f_out);
 #if defined HAVE_LUTIMES && defined HAVE_UTIMES
 	} else if (!am_sender) {
 		receiver_symlink_times = 1;
 #endif
 	}
 
+	if (!(compat_flags & CF_CHKSUM_NEGO)) {
+		check_unnegotiated_choice("checksum-choice", checksum_choice,
+					  checksum_name());
+		check_unnegotiated_choice("rolling-choice", rolling_choice,
+					  rolling_checksum_name());
+	}
+
 	if (need_unsorted_flist && (!am_sender || inc_recurse))
 		unsort_ndx = ++file_extra_cnt;
 
@@ -320,4 +411,7 @@ void setup_protocol(int f_out,int f_in)
 	} else {
 		checksum_seed = read_int(f_in);
 	}
+
+	if (buffering)
+		io_end_buffering_out();
 }
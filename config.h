@@ -77,12 +77,18 @@
 /* Define to 1 if you have the `chown' function. */
 #define HAVE_CHOWN 1
 
+/* Define to 1 if you have the `clock_gettime' function. */
+#define HAVE_CLOCK_GETTIME 1
+
 /* Define to 1 if you have the <compat.h> header file. */
 /* #undef HAVE_COMPAT_H */
 
 /* Define to 1 if you have the "connect" function */
 #define HAVE_CONNECT 1
 
+/* Define to 1 if you have the `copy_file_range' function. */
+/* #undef HAVE_COPY_FILE_RANGE */
+
 /* Define to 1 if you have the <ctype.h> header file. */
 #define HAVE_CTYPE_H 1
 
@@ -90,12 +96,18 @@
    */
 #define HAVE_DIRENT_H 1
 
+/* Define to 1 if you have the `epoll_create1' function. */
+#define HAVE_EPOLL_CREATE1 1
+
 /* Define to 1 if errno is declared in errno.h */
 #define HAVE_ERRNO_DECL 1
 
 /* Define to 1 if you have the `extattr_get_link' function. */
 /* #undef HAVE_EXTATTR_GET_LINK */
 
+/* Define to 1 if you have the `fallocate' function. */
+/* #undef HAVE_FALLOCATE */
+
 /* Define to 1 if you have the `fchmod' function. */
 #define HAVE_FCHMOD 1
 
@@ -207,6 +219,12 @@
 /* Define to 1 if you have the `link' function. */
 #define HAVE_LINK 1
 
+/* Define to 1 if you have the <linux/fs.h> header file. */
+#define HAVE_LINUX_FS_H 1
+
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+/* #undef HAVE_LINUX_IO_URING_H */
+
 /* True if you have Linux xattrs */
 /* #undef HAVE_LINUX_XATTRS */
 
@@ -230,6 +248,9 @@
 /* Define to 1 if you have the `lutimes' function. */
 /* #undef HAVE_LUTIMES */
 
+/* Define to 1 if you have the `madvise' function. */
+#define HAVE_MADVISE 1
+
 /* Define to 1 if you have the `mallinfo' function. */
 #define HAVE_MALLINFO 1
 
@@ -252,6 +273,9 @@
 /* Define to 1 if you have the `mknod' function. */
 #define HAVE_MKNOD 1
 
+/* Define to 1 if you have the `mmap' function. */
+#define HAVE_MMAP 1
+
 /* Define to 1 if you have the `mkstemp64' function. */
 /* #undef HAVE_MKSTEMP64 */
 
@@ -285,12 +309,36 @@
 /* Define to 1 if the system has the type `pid_t'. */
 #define HAVE_PID_T 1
 
+/* Define to 1 if you have the `poll' function. */
+#define HAVE_POLL 1
+
+/* Define to 1 if you have the <poll.h> header file. */
+#define HAVE_POLL_H 1
+
 /* Define to 1 if you have the <popt.h> header file. */
 /* #undef HAVE_POPT_H */
 
 /* Define to 1 if you have the <popt/popt.h> header file. */
 /* #undef HAVE_POPT_POPT_H */
 
+/* Define to 1 if you have the `posix_fadvise' function. */
+#define HAVE_POSIX_FADVISE 1
+
+/* Define to 1 if you have the `posix_fallocate' function. */
+/* #undef HAVE_POSIX_FALLOCATE */
+
+/* Define to 1 if you have the `posix_memalign' function. */
+#define HAVE_POSIX_MEMALIGN 1
+
+/* Define to 1 if you have the `pread' function. */
+#define HAVE_PREAD 1
+
+/* Define to 1 if you have the `pthread_create' function. */
+#define HAVE_PTHREAD_CREATE 1
+
+/* Define to 1 if you have the <pthread.h> header file. */
+#define HAVE_PTHREAD_H 1
+
 /* true if you have posix ACLs */
 /* #undef HAVE_POSIX_ACLS */
 
@@ -402,12 +450,21 @@
 /* Define to 1 if the system has the type `struct stat64'. */
 #define HAVE_STRUCT_STAT64 1
 
+/* Define to 1 if `st_mtim.tv_nsec' is a member of `struct stat'. */
+#define HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC 1
+
 /* Define to 1 if `st_rdev' is member of `struct stat'. */
 #define HAVE_STRUCT_STAT_ST_RDEV 1
 
 /* Define to 1 if you have the "struct utimbuf" type */
 #define HAVE_STRUCT_UTIMBUF 1
 
+/* Define to 1 if the compiler has the __sync atomic builtins */
+#define HAVE_SYNC_BUILTINS 1
+
+/* Define to 1 if you have the `sync_file_range' function. */
+#define HAVE_SYNC_FILE_RANGE 1
+
 /* Define to 1 if you have the <sys/acl.h> header file. */
 /* #undef HAVE_SYS_ACL_H */
 
@@ -418,6 +475,9 @@
    */
 /* #undef HAVE_SYS_DIR_H */
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
 /* Define to 1 if you have the <sys/extattr.h> header file. */
 /* #undef HAVE_SYS_EXTATTR_H */
 
@@ -430,6 +490,9 @@
 /* Define to 1 if you have the <sys/ioctl.h> header file. */
 #define HAVE_SYS_IOCTL_H 1
 
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#define HAVE_SYS_MMAN_H 1
+
 /* Define to 1 if you have the <sys/mode.h> header file. */
 /* #undef HAVE_SYS_MODE_H */
 
@@ -449,12 +512,18 @@
 /* Define to 1 if you have the <sys/stat.h> header file. */
 #define HAVE_SYS_STAT_H 1
 
+/* Define to 1 if you have the <sys/syscall.h> header file. */
+#define HAVE_SYS_SYSCALL_H 1
+
 /* Define to 1 if you have the <sys/time.h> header file. */
 #define HAVE_SYS_TIME_H 1
 
 /* Define to 1 if you have the <sys/types.h> header file. */
 #define HAVE_SYS_TYPES_H 1
 
+/* Define to 1 if you have the <sys/uio.h> header file. */
+#define HAVE_SYS_UIO_H 1
+
 /* Define to 1 if you have the <sys/unistd.h> header file. */
 /* #undef HAVE_SYS_UNISTD_H */
 
@@ -506,6 +575,9 @@
 /* Define to 1 if you have the `waitpid' function. */
 #define HAVE_WAITPID 1
 
+/* Define to 1 if you have the `writev' function. */
+#define HAVE_WRITEV 1
+
 /* Define to 1 if you have the `_acl' function. */
 /* #undef HAVE__ACL */
 
@@ -626,6 +698,9 @@
 /* The size of `uint32_t', as computed by sizeof. */
 #define SIZEOF_UINT32_T 4
 
+/* The size of `uint64_t', as computed by sizeof. */
+#define SIZEOF_UINT64_T 8
+
 /* If using the C implementation of alloca, define if you know the
    direction of stack growth for your system; otherwise it will be
    automatically deduced at runtime.
@@ -0,0 +1,332 @@
+/*
+ * Waiting for the fds that io.c reads and writes to become ready.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+/*
+ * A wait names the fds it is interested in with evloop_add(), calls
+ * evloop_wait(), and then asks evloop_ready() which of them can be used.
+ * Where the system has epoll, the fds stay registered with the kernel from
+ * one wait to the next, so the usual wait (the same socket and message fd
+ * as the last one) costs just the epoll_wait() call; an fd only gets an
+ * epoll_ctl() when what we want from it changes.  Elsewhere (or if epoll
+ * won't take an fd, such as a batch file) the wait uses poll().
+ */
+
+#include "rsync.h"
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+#if defined HAVE_SYS_EPOLL_H && defined HAVE_EPOLL_CREATE1
+#include <sys/epoll.h>
+#define USE_EPOLL 1
+#endif
+
+#define MAX_EV_FDS 8
+
+static struct ev_fd {
+	int fd;
+	int want;	/* what the coming wait is for */
+	int reg;	/* what epoll was last told */
+	int ready;	/* what the last wait found */
+	int no_epoll;	/* epoll won't take it (e.g. a regular file) */
+} ev_fds[MAX_EV_FDS];
+static int ev_cnt;
+
+#ifdef USE_EPOLL
+static int epoll_fd = -1;
+static int no_epoll;
+
+/* Stop using the epoll instance, which forgets all its registrations. */
+static void drop_epoll(void)
+{
+	int j;
+
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+	for (j = 0; j < ev_cnt; j++)
+		ev_fds[j].reg = 0;
+}
+
+static int epoll_events(int events)
+{
+	return (events & EVL_READ ? EPOLLIN : 0)
+	     | (events & EVL_WRITE ? EPOLLOUT : 0);
+}
+
+/* Tell epoll about the fds whose wants have changed.  Returns 0 if the
+ * wait can use epoll, or -1 if an fd needs poll() this time. */
+static int update_epoll(void)
+{
+	struct epoll_event ev;
+	int j, op, ret = 0;
+
+	if (epoll_fd < 0) {
+		if (no_epoll)
+			return -1;
+		if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			no_epoll = 1;
+			return -1;
+		}
+	}
+
+	for (j = 0; j < ev_cnt; j++) {
+		struct ev_fd *e = &ev_fds[j];
+		if (e->want && e->no_epoll)
+			ret = -1;
+		if (e->want == e->reg || e->fd < 0 || e->no_epoll)
+			continue;
+		if (!e->want) {
+			/* A closed fd has already been dropped. */
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, e->fd, &ev);
+			e->reg = 0;
+			continue;
+		}
+		memset(&ev, 0, sizeof ev);
+		ev.events = epoll_events(e->want);
+		ev.data.fd = e->fd;
+		op = e->reg ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		if (epoll_ctl(epoll_fd, op, e->fd, &ev) < 0) {
+			/* The fd was closed and reopened since we last saw it. */
+			if (errno == EEXIST || errno == ENOENT) {
+				op = errno == EEXIST ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+				if (epoll_ctl(epoll_fd, op, e->fd, &ev) == 0) {
+					e->reg = e->want;
+					continue;
+				}
+			}
+			/* A regular file (EPERM) or a bad fd is left to poll(),
+			 * which says what select() would have said. */
+			if (errno == EPERM)
+				e->no_epoll = 1;
+			else if (errno != EBADF)
+				drop_epoll();
+			e->reg = 0;
+			ret = -1;
+			continue;
+		}
+		e->reg = e->want;
+	}
+
+	return ret;
+}
+
+static int wait_epoll(int msecs)
+{
+	struct epoll_event evs[MAX_EV_FDS];
+	int cnt, found, j, k;
+
+	cnt = epoll_wait(epoll_fd, evs, MAX_EV_FDS, msecs);
+
+	for (k = found = 0; k < cnt; k++) {
+		for (j = 0; j < ev_cnt; j++) {
+			if (ev_fds[j].fd == evs[k].data.fd && ev_fds[j].want)
+				break;
+		}
+		if (j == ev_cnt)
+			continue;
+		if (evs[k].events & (EPOLLERR | EPOLLHUP))
+			ev_fds[j].ready = ev_fds[j].want;
+		else {
+			ev_fds[j].ready = (evs[k].events & EPOLLIN ? EVL_READ : 0)
+					| (evs[k].events & EPOLLOUT ? EVL_WRITE : 0);
+		}
+		found++;
+	}
+
+	/* Only a registration left behind by an fd that got closed while a
+	 * dup of it stayed open could wake us for nothing, so start over. */
+	if (cnt > 0 && !found) {
+		drop_epoll();
+		errno = EINTR;
+		return -1;
+	}
+
+	return found;
+}
+#endif
+
+#ifdef HAVE_POLL
+static int wait_poll(int msecs)
+{
+	struct pollfd pfds[MAX_EV_FDS];
+	int cnt, j, n;
+
+	for (j = n = 0; j < ev_cnt; j++) {
+		if (!ev_fds[j].want)
+			continue;
+		pfds[n].fd = ev_fds[j].fd;
+		pfds[n].events = (ev_fds[j].want & EVL_READ ? POLLIN : 0)
+			       | (ev_fds[j].want & EVL_WRITE ? POLLOUT : 0);
+		pfds[n].revents = 0;
+		n++;
+	}
+
+	if ((cnt = poll(pfds, n, msecs)) <= 0)
+		return cnt;
+
+	for (j = n = 0; j < ev_cnt; j++) {
+		if (!ev_fds[j].want)
+			continue;
+		if (pfds[n].revents & POLLNVAL) {
+			errno = EBADF;
+			return -1;
+		}
+		if (pfds[n].revents & (POLLERR | POLLHUP))
+			ev_fds[j].ready = ev_fds[j].want;
+		else {
+			ev_fds[j].ready = (pfds[n].revents & POLLIN ? EVL_READ : 0)
+					| (pfds[n].revents & POLLOUT ? EVL_WRITE : 0);
+		}
+		n++;
+	}
+
+	return cnt;
+}
+#else
+static int wait_poll(int msecs)
+{
+	fd_set r_fds, w_fds;
+	struct timeval tv;
+	int cnt, j, maxfd = -1;
+
+	FD_ZERO(&r_fds);
+	FD_ZERO(&w_fds);
+	for (j = 0; j < ev_cnt; j++) {
+		if (!ev_fds[j].want)
+			continue;
+		if (ev_fds[j].want & EVL_READ)
+			FD_SET(ev_fds[j].fd, &r_fds);
+		if (ev_fds[j].want & EVL_WRITE)
+			FD_SET(ev_fds[j].fd, &w_fds);
+		if (ev_fds[j].fd > maxfd)
+			maxfd = ev_fds[j].fd;
+	}
+
+	tv.tv_sec = msecs / 1000;
+	tv.tv_usec = (msecs % 1000) * 1000;
+
+	if ((cnt = select(maxfd + 1, &r_fds, &w_fds, NULL, &tv)) <= 0)
+		return cnt;
+
+	for (j = 0; j < ev_cnt; j++) {
+		if (!ev_fds[j].want)
+			continue;
+		ev_fds[j].ready = (FD_ISSET(ev_fds[j].fd, &r_fds) ? EVL_READ : 0)
+				| (FD_ISSET(ev_fds[j].fd, &w_fds) ? EVL_WRITE : 0);
+	}
+
+	return cnt;
+}
+#endif
+
+/* Add what we want from fd (EVL_READ and/or EVL_WRITE) to the next wait.
+ * A negative fd is ignored. */
+void evloop_add(int fd, int events)
+{
+	int j, free_j = -1;
+
+	if (fd < 0)
+		return;
+
+	for (j = 0; j < ev_cnt; j++) {
+		if (ev_fds[j].fd == fd) {
+			ev_fds[j].want |= events;
+			return;
+		}
+		if (ev_fds[j].fd < 0 && free_j < 0)
+			free_j = j;
+	}
+
+	if (free_j < 0) {
+		if (ev_cnt == MAX_EV_FDS) {
+			rprintf(FERROR, "evloop_add: too many fds [%s]\n", who_am_i());
+			exit_cleanup(RERR_UNSUPPORTED);
+		}
+		free_j = ev_cnt++;
+	}
+
+	ev_fds[free_j].fd = fd;
+	ev_fds[free_j].want = events;
+	ev_fds[free_j].reg = 0;
+	ev_fds[free_j].ready = 0;
+	ev_fds[free_j].no_epoll = 0;
+}
+
+/* Wait up to secs seconds for one of the fds given to evloop_add() to be
+ * ready.  Returns how many are ready (0 for a timeout), or -1 with errno
+ * set, just like select().  The fds must be added again for the next
+ * wait. */
+int evloop_wait(int secs)
+{
+	int cnt, j;
+#ifdef USE_EPOLL
+	int use_epoll;
+#endif
+
+	for (j = 0; j < ev_cnt; j++)
+		ev_fds[j].ready = 0;
+
+#ifdef USE_EPOLL
+	use_epoll = update_epoll() == 0;
+#endif
+
+	/* An fd that this wait didn't add is now unregistered, so it's
+	 * forgotten. */
+	for (j = 0; j < ev_cnt; j++) {
+		if (!ev_fds[j].want && !ev_fds[j].reg)
+			ev_fds[j].fd = -1;
+	}
+	while (ev_cnt && ev_fds[ev_cnt-1].fd < 0)
+		ev_cnt--;
+
+#ifdef USE_EPOLL
+	if (use_epoll)
+		cnt = wait_epoll(secs * 1000);
+	else
+#endif
+		cnt = wait_poll(secs * 1000);
+
+	for (j = 0; j < ev_cnt; j++)
+		ev_fds[j].want = 0;
+
+	return cnt;
+}
+
+/* Return what the last evloop_wait() found fd to be ready for. */
+int evloop_ready(int fd)
+{
+	int j;
+
+	for (j = 0; j < ev_cnt; j++) {
+		if (ev_fds[j].fd == fd)
+			return ev_fds[j].ready;
+	}
+
+	return 0;
+}
+
+/* A forked child shares its parent's epoll instance, so it needs one of
+ * its own. */
+void evloop_reset(void)
+{
+#ifdef USE_EPOLL
+	drop_epoll();
+#endif
+	ev_cnt = 0;
+}
@@ -20,15 +20,114 @@
  */
 
 #include "rsync.h"
+#ifdef SUPPORT_MMAP
+#include <setjmp.h>
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+#endif
 
 #ifndef ENODATA
 #define ENODATA EAGAIN
 #endif
 
+#if !defined MAP_ANONYMOUS && defined MAP_ANON
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#if defined SUPPORT_THREADS && defined HAVE_PREAD
+#define SUPPORT_PREFETCH 1
+#endif
+
 extern int sparse_files;
+extern int sparse_block;
+extern int inplace;
+extern int use_mmap;
+extern int use_prefetch;
+extern int use_io_uring;
+extern int do_stats;
+extern int verbose;
+extern int drop_cache;
+extern int preallocate_files;
+extern OFF_T direct_io_min;
+extern struct stats stats;
 
-static char last_byte;
 static OFF_T sparse_seek = 0;
+static int32 sparse_min = SPARSE_MIN_HOLE;
+static OFF_T prealloc_len; /* the space --preallocate reserved for the file */
+
+/* The time spent waiting on file reads is only measured when --mmap or
+ * --prefetch is on (since it shows what they save) or for -vv --stats. */
+static int timing_reads(void)
+{
+	return use_mmap || use_prefetch || (do_stats && verbose > 1);
+}
+
+/* Note the time that a file read starts (if we're timing them). */
+static void start_read_wait(struct timeval *tv)
+{
+	if (timing_reads())
+		gettimeofday(tv, NULL);
+}
+
+/* Add the time since *tv to the time we've spent waiting on file reads. */
+static void add_read_wait(struct timeval *tv)
+{
+	struct timeval now;
+
+	if (!timing_reads())
+		return;
+	gettimeofday(&now, NULL);
+	stats.read_wait_time += (int64)(now.tv_sec - tv->tv_sec) * 1000000
+			      + (now.tv_usec - tv->tv_usec);
+}
+
+/* Get rid of any data in the len bytes at the current offset of f, which
+ * --sparse wants to be a hole, and seek past them.  A new file has nothing
+ * there (unless --preallocate reserved the space, which we punch out), but
+ * an --inplace file may have old data, which we punch out (or overwrite
+ * with zeros, if the filesystem can't punch holes). */
+static int skip_hole(int f, OFF_T len)
+{
+	static const char zeros[4096];
+
+	if (inplace || prealloc_len) {
+#if defined HAVE_FALLOCATE && defined FALLOC_FL_PUNCH_HOLE
+		OFF_T pos = do_lseek(f, 0, SEEK_CUR);
+		if (pos >= 0 && fallocate(f, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+					  pos, len) == 0)
+			return do_lseek(f, len, SEEK_CUR) == pos + len ? 0 : -1;
+#endif
+	}
+
+	if (inplace) {
+		while (len > 0) {
+			int ret = write(f, zeros, (size_t)MIN(len, (OFF_T)sizeof zeros));
+			if (ret <= 0) {
+				if (ret < 0 && errno == EINTR)
+					continue;
+				return -1;
+			}
+			len -= ret;
+		}
+		return 0;
+	}
+
+	return do_lseek(f, len, SEEK_CUR) < 0 ? -1 : 0;
+}
+
+/* Skip over the zeros that write_sparse() has saved up (if any).  This is
+ * needed before the file offset gets moved in some other way. */
+int sparse_flush(int f)
+{
+	OFF_T len = sparse_seek;
+
+	if (!len)
+		return 0;
+	sparse_seek = 0;
+
+	return skip_hole(f, len);
+}
 
 int sparse_end(int f)
 {
@@ -37,7 +136,9 @@ int sparse_end(int f)
 	if (!sparse_seek)
 		return 0;
 
-	do_lseek(f, sparse_seek-1, SEEK_CUR);
+	/* The last byte gets written to give the file its full length. */
+	if (sparse_seek > 1 && skip_hole(f, sparse_seek - 1) < 0)
+		return -1;
 	sparse_seek = 0;
 
 	do {
@@ -47,90 +148,426 @@ int sparse_end(int f)
 	return ret <= 0 ? -1 : 0;
 }
 
+/* Choose the shortest run of zeros that write_sparse() turns into a hole
+ * for the file f: the --sparse-block size, or else the filesystem's block
+ * size (since a shorter run can't free up any space). */
+void set_sparse_block(int f)
+{
+	STRUCT_STAT st;
 
+	if (sparse_block)
+		sparse_min = sparse_block;
+	else if (do_fstat(f, &st) == 0 && st.st_blksize > 0)
+		sparse_min = MIN(MAX((int32)st.st_blksize, SPARSE_MIN_HOLE), SPARSE_MAX_HOLE);
+	else
+		sparse_min = SPARSE_MIN_HOLE;
+}
+
+/* Write buf, skipping over its runs of zeros so that they become holes.
+ * A run of zeros at the end is saved up in sparse_seek, so that it can be
+ * joined with the zeros that start the next write. */
 static int write_sparse(int f, char *buf, int len)
 {
-	int l1 = 0, l2 = 0;
-	int ret;
+	int pos, run, ret;
 
-	for (l1 = 0; l1 < len && buf[l1] == 0; l1++) {}
-	for (l2 = 0; l2 < len-l1 && buf[len-(l2+1)] == 0; l2++) {}
+	for (pos = 0; pos < len; pos += run) {
+		if ((run = count_zeros(buf + pos, len - pos)) > 0) {
+			sparse_seek += run;
+			continue;
+		}
+
+		run = find_zero_run(buf + pos, len - pos, sparse_min);
+		if (sparse_flush(f) < 0)
+			return pos ? pos : -1;
+		for (ret = 0; ret < run; ) {
+			int n = write(f, buf + pos + ret, run - ret);
+			if (n <= 0) {
+				if (n < 0 && errno == EINTR)
+					continue;
+				return pos + ret ? pos + ret : n;
+			}
+			stats.file_write_calls++;
+			stats.file_write_bytes += n;
+			ret += n;
+		}
+	}
+
+	return len;
+}
 
-	/* XXX Riddle me this: why does this function SLOW DOWN when I
-	 * remove the following (unneeded) line?? Core Duo weirdness? */
-	last_byte = buf[len-1];
 
-	sparse_seek += l1;
+static char *wf_writeBuf;
+static size_t wf_writeBufSize; /* how much of it the current file uses */
+static size_t wf_writeBufAlloc;
+static size_t wf_writeBufCnt;
+static int wf_uring; /* the write buffers belong to the io_uring code */
+static int wf_direct; /* O_DIRECT is on for the file being written */
+static OFF_T wf_synced, wf_dropped; /* the --drop-cache progress in it */
 
-	if (l1 == len)
-		return len;
+#ifdef SUPPORT_DIRECT_IO
+#define DIRECT_ALIGN(n) (((n) + DIRECT_IO_ALIGN - 1) & ~(DIRECT_IO_ALIGN - 1))
 
-	if (sparse_seek)
-		do_lseek(f, sparse_seek, SEEK_CUR);
-	sparse_seek = l2;
+/* Turn O_DIRECT on or off for fd.  Returns -1 if the fd won't take it. */
+static int set_direct_io(int fd, int on)
+{
+	int flags = fcntl(fd, F_GETFL);
 
-	while ((ret = write(f, buf + l1, len - (l1+l2))) <= 0) {
-		if (ret < 0 && errno == EINTR)
-			continue;
-		return ret;
+	if (flags < 0)
+		return -1;
+	return fcntl(fd, F_SETFL, on ? flags | O_DIRECT : flags & ~O_DIRECT);
+}
+#endif
+
+/* Return the size of the writes that the device under f likes best: its
+ * optimal I/O size (such as a RAID stripe width) where Linux tells us what
+ * that is, or else the filesystem's block size. */
+static size_t optimal_write_size(int f)
+{
+	static dev_t last_dev;
+	static size_t last_size;
+	STRUCT_STAT st;
+
+	if (do_fstat(f, &st) < 0)
+		return 0;
+	if (last_size && st.st_dev == last_dev)
+		return last_size;
+
+	last_dev = st.st_dev;
+	last_size = st.st_blksize > 0 ? (size_t)st.st_blksize : 1;
+
+#ifdef __linux__
+	{
+		/* A partition has no queue dir of its own, so we look in
+		 * its disk's dir if need be. */
+		static const char *paths[] = {
+			"queue/optimal_io_size", "../queue/optimal_io_size"
+		};
+		char fn[MAXPATHLEN];
+		unsigned long n;
+		FILE *fp;
+		int j;
+
+		for (j = 0; j < 2; j++) {
+			snprintf(fn, sizeof fn, "/sys/dev/block/%u:%u/%s",
+				 (unsigned)major(st.st_dev),
+				 (unsigned)minor(st.st_dev), paths[j]);
+			if (!(fp = fopen(fn, "r")))
+				continue;
+			if (fscanf(fp, "%lu", &n) == 1 && n > last_size)
+				last_size = n;
+			fclose(fp);
+			break;
+		}
 	}
+#endif
 
-	if (ret != (int)(len - (l1+l2)))
-		return l1+ret;
+	return last_size;
+}
 
-	return len;
+/* Make sure that the write buffer holds at least size bytes.  The io_uring
+ * code owns its buffers, so they keep the size they started with. */
+static void alloc_write_buf(size_t size)
+{
+#ifdef SUPPORT_IO_URING
+	if (!wf_writeBuf && use_io_uring && uring_init(size)) {
+		wf_uring = 1;
+		wf_writeBuf = uring_buffer();
+		wf_writeBufAlloc = size;
+		return;
+	}
+	if (wf_uring)
+		return;
+#endif
+	if (wf_writeBuf && size <= wf_writeBufAlloc)
+		return;
+
+	if (wf_writeBuf)
+		free(wf_writeBuf);
+	wf_writeBuf = NULL;
+#ifdef SUPPORT_DIRECT_IO
+	if (direct_io_min) {
+		void *p;
+		if (posix_memalign(&p, DIRECT_IO_ALIGN, size) == 0)
+			wf_writeBuf = p;
+	} else
+#endif
+		wf_writeBuf = new_array(char, size);
+	if (!wf_writeBuf)
+		out_of_memory("alloc_write_buf");
+	wf_writeBufAlloc = size;
 }
 
+/* Size the write buffer for a file of the given size that is about to be
+ * written to f: WRITE_BUF_SIZE for a big file (less for a small one),
+ * rounded up to a multiple of the device's optimal write size. */
+static void size_write_buf(int f, OFF_T size)
+{
+	size_t want = WRITE_BUF_SIZE, opt = optimal_write_size(f);
+
+	if (size < (OFF_T)want)
+		want = MAX((size_t)size, WRITE_SIZE * 8);
+	if (opt > 1)
+		want = (want + opt - 1) / opt * opt;
+	if (want > MAX_WRITE_BUF_SIZE)
+		want = MAX_WRITE_BUF_SIZE;
+#ifdef SUPPORT_DIRECT_IO
+	want = DIRECT_ALIGN(want);
+#endif
 
-static char *wf_writeBuf;
-static size_t wf_writeBufSize;
-static size_t wf_writeBufCnt;
+	alloc_write_buf(want);
+	wf_writeBufSize = MIN(want, wf_writeBufAlloc);
+}
+
+/* With --drop-cache, get the data that we've written to f out of the page
+ * cache.  Dirty pages can't be dropped, so we start the kernel writing out
+ * each DROP_CACHE_STEP of the file, and drop the step before it once that
+ * is on the disk (which it usually is by then).  At the end of the file we
+ * wait for the rest to be written and drop the lot. */
+static void drop_write_cache(int f, int final)
+{
+	OFF_T pos;
+
+	if (final) {
+#ifdef HAVE_SYNC_FILE_RANGE
+		sync_file_range(f, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE
+			      | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+		fsync(f);
+#endif
+#ifdef HAVE_POSIX_FADVISE
+		posix_fadvise(f, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+		return;
+	}
+
+	if ((pos = do_lseek(f, 0, SEEK_CUR)) < wf_synced)
+		wf_synced = wf_dropped = pos;
+	if (pos - wf_synced < DROP_CACHE_STEP)
+		return;
+
+#if defined HAVE_SYNC_FILE_RANGE && defined HAVE_POSIX_FADVISE
+	sync_file_range(f, wf_synced, pos - wf_synced, SYNC_FILE_RANGE_WRITE);
+	if (wf_synced > wf_dropped) {
+		sync_file_range(f, wf_dropped, wf_synced - wf_dropped,
+				SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+			      | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(f, wf_dropped, wf_synced - wf_dropped,
+			      POSIX_FADV_DONTNEED);
+	}
+	wf_dropped = wf_synced;
+#endif
+	wf_synced = pos;
+}
+
+/* Get ready to write a file of the given size to f, sizing the write
+ * buffer to suit the file and its device.  With --preallocate,
+ * the file's space is reserved up front, so that the filesystem can lay it
+ * out in a few big extents instead of finding room for it a write at a
+ * time.  With --direct-io, a big enough file gets written with O_DIRECT
+ * (unless it's being written in a way that can't keep the writes aligned).
+ * Returns 1 if it does. */
+int begin_write_file(int f, OFF_T size)
+{
+	wf_synced = wf_dropped = 0;
+	wf_direct = 0;
+	prealloc_len = 0;
+
+	if (sparse_files <= 0)
+		size_write_buf(f, size);
+
+#ifdef SUPPORT_PREALLOCATION
+	/* A failure (such as a filesystem without fallocate) isn't an error,
+	 * since the writes will allocate the space anyway.  The file keeps
+	 * its size where possible, so that an interrupted transfer doesn't
+	 * leave it padded out with zeros.  Otherwise the space is allocated
+	 * by extending the file (which an --inplace update can't risk), and
+	 * it's up to end_write_file() to cut it back. */
+	if (preallocate_files && size > 0
+	 && (do_fallocate(f, 0, size, 1) == 0
+	  || (!inplace && do_fallocate(f, 0, size, 0) == 0)))
+		prealloc_len = size;
+#endif
+
+#ifdef SUPPORT_DIRECT_IO
+	if (direct_io_min && size >= direct_io_min && !inplace
+	 && sparse_files <= 0 && !use_io_uring)
+		wf_direct = set_direct_io(f, 1) == 0;
+#endif
+
+	return wf_direct;
+}
+
+/* Finish up after the last write_file(), flush_write_file(), and
+ * sparse_end() to f, which leave the file offset at the end of its data.
+ * If the file came up shorter than the size it was preallocated to
+ * (because it changed while it was being sent), it is cut down to size. */
+int end_write_file(int f)
+{
+	int ret = 0;
+
+#ifdef SUPPORT_DIRECT_IO
+	if (wf_direct) {
+		set_direct_io(f, 0);
+		wf_direct = 0;
+	}
+#endif
+#ifdef HAVE_FTRUNCATE
+	if (prealloc_len) {
+		OFF_T pos = do_lseek(f, 0, SEEK_CUR);
+		if (pos < 0 || (pos < prealloc_len && ftruncate(f, pos) < 0))
+			ret = -1;
+	}
+#endif
+	prealloc_len = 0;
+	if (drop_cache)
+		drop_write_cache(f, 1);
+
+	return ret;
+}
+
+#ifdef SUPPORT_IO_URING
+/* Hand the write buffer to the io_uring code and get an empty one back. */
+static int queue_write_buf(int f)
+{
+	char *next = uring_write(f, wf_writeBuf, wf_writeBufCnt);
+
+	if (!next)
+		return -1;
+	stats.file_write_calls++;
+	stats.file_write_bytes += wf_writeBufCnt;
+	wf_writeBuf = next;
+	wf_writeBufCnt = 0;
+
+	return 0;
+}
+#endif
 
 int flush_write_file(int f)
 {
 	int ret = 0;
 	char *bp = wf_writeBuf;
 
+#ifdef SUPPORT_IO_URING
+	if (wf_uring) {
+		if (wf_writeBufCnt && queue_write_buf(f) < 0)
+			return -1;
+		return uring_wait(f);
+	}
+#endif
+
+#ifdef SUPPORT_DIRECT_IO
+	/* O_DIRECT only writes whole blocks, so the partial block at the
+	 * end of a file has to be written without it. */
+	if (wf_direct && wf_writeBufCnt % DIRECT_IO_ALIGN) {
+		set_direct_io(f, 0);
+		wf_direct = 0;
+	}
+#endif
+
 	while (wf_writeBufCnt > 0) {
 		if ((ret = write(f, bp, wf_writeBufCnt)) < 0) {
 			if (errno == EINTR)
 				continue;
+#ifdef SUPPORT_DIRECT_IO
+			if (errno == EINVAL && wf_direct) {
+				/* It won't take O_DIRECT after all. */
+				set_direct_io(f, 0);
+				wf_direct = 0;
+				continue;
+			}
+#endif
 			return ret;
 		}
+		stats.file_write_calls++;
+		stats.file_write_bytes += ret;
 		wf_writeBufCnt -= ret;
 		bp += ret;
 	}
+
+	if (drop_cache)
+		drop_write_cache(f, 0);
+
 	return ret;
 }
 
+#ifdef HAVE_WRITEV
+/* Write out the buffered data followed by the len bytes in buf with one
+ * writev(), which saves copying buf into the buffer when it would just fill
+ * the buffer up anyway.  Returns len, or -1 on error. */
+static int write_gathered(int f, char *buf, int len)
+{
+	struct iovec iov[2], *v = iov;
+	int cnt = 0;
+	ssize_t n;
+
+	if (wf_writeBufCnt) {
+		iov[cnt].iov_base = wf_writeBuf;
+		iov[cnt++].iov_len = wf_writeBufCnt;
+	}
+	iov[cnt].iov_base = buf;
+	iov[cnt++].iov_len = len;
+
+	while (cnt) {
+		if ((n = writev(f, v, cnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		stats.file_write_calls++;
+		stats.file_write_bytes += n;
+		for ( ; cnt && (size_t)n >= v->iov_len; v++, cnt--)
+			n -= v->iov_len;
+		if (cnt) {
+			v->iov_base = (char *)v->iov_base + n;
+			v->iov_len -= n;
+		}
+	}
+	wf_writeBufCnt = 0;
+
+	if (drop_cache)
+		drop_write_cache(f, 0);
+
+	return len;
+}
+#endif
+
 
 /*
  * write_file does not allow incomplete writes.  It loops internally
- * until len bytes are written or errno is set.
+ * until len bytes are written or errno is set.  Small writes are gathered
+ * up in the write buffer, and data that would fill the buffer goes out
+ * along with it (without being copied) where that's possible.
  */
 int write_file(int f, char *buf, int len)
 {
 	int ret = 0;
 
+	if (!wf_writeBufSize && sparse_files <= 0)
+		size_write_buf(f, WRITE_BUF_SIZE);
+
 	while (len > 0) {
 		int r1;
-		if (sparse_files > 0) {
-			int len1 = MIN(len, SPARSE_WRITE_SIZE);
-			r1 = write_sparse(f, buf, len1);
-		} else {
-			if (!wf_writeBuf) {
-				wf_writeBufSize = WRITE_SIZE * 8;
-				wf_writeBufCnt  = 0;
-				wf_writeBuf = new_array(char, wf_writeBufSize);
-				if (!wf_writeBuf)
-					out_of_memory("write_file");
-			}
+		if (sparse_files > 0)
+			r1 = write_sparse(f, buf, len);
+#ifdef HAVE_WRITEV
+		/* The io_uring and O_DIRECT writes have to be in our buffer. */
+		else if (!wf_uring && !wf_direct
+		      && wf_writeBufCnt + len >= wf_writeBufSize)
+			r1 = write_gathered(f, buf, len);
+#endif
+		else {
 			r1 = (int)MIN((size_t)len, wf_writeBufSize - wf_writeBufCnt);
 			if (r1) {
 				memcpy(wf_writeBuf + wf_writeBufCnt, buf, r1);
 				wf_writeBufCnt += r1;
 			}
 			if (wf_writeBufCnt == wf_writeBufSize) {
+#ifdef SUPPORT_IO_URING
+				if (wf_uring) {
+					if (queue_write_buf(f) < 0)
+						return -1;
+				} else
+#endif
 				if (flush_write_file(f) < 0)
 					return -1;
 				if (!r1 && len)
@@ -150,10 +587,443 @@ int write_file(int f, char *buf, int len)
 }
 
 
-/* This provides functionality somewhat similar to mmap() but using read().
- * It gives sliding window access to a file.  mmap() is not used because of
- * the possibility of another program (such as a mailer) truncating the
- * file thus giving us a SIGBUS. */
+#ifdef SUPPORT_MMAP
+/* With --mmap, a file that gets truncated while we have it mapped gives us
+ * a SIGBUS when we touch a page past its new end.  We touch each window's
+ * pages in map_ptr() before handing it out, with a siglongjmp() back out
+ * of the handler if a page is gone, which lets map_ptr() fall back to
+ * read() (and its zero-filling and map->status error).  If a page goes
+ * away after that, the handler maps a page of zeros over it instead and
+ * the error is noted when the file is unmapped. */
+#define MAX_MMAPS 8
+
+static struct {
+	char *start;
+	size_t len;
+	volatile sig_atomic_t faulted;
+} mmaps[MAX_MMAPS];
+
+static struct sigaction old_sigbus_action;
+static sigjmp_buf touch_jmp;
+static const char *volatile touch_start, *volatile touch_end;
+static volatile char touch_sum;
+static size_t page_size;
+
+/* POSIX doesn't list mmap() as async-signal-safe, so this handler relies on
+ * Linux, where mmap() is a single system call (the C library's wrapper takes
+ * no locks and allocates nothing), and where a MAP_FIXED mapping replaces
+ * the old page atomically.  Other systems don't get SUPPORT_MMAP. */
+static void mmap_sigbus_handler(UNUSED(int sig), siginfo_t *si, UNUSED(void *ctx))
+{
+	char *addr = si->si_addr;
+	int j;
+
+	if (addr >= touch_start && addr < touch_end) {
+		touch_start = touch_end = NULL;
+		siglongjmp(touch_jmp, 1);
+	}
+
+	for (j = 0; j < MAX_MMAPS; j++) {
+		if (addr >= mmaps[j].start && addr < mmaps[j].start + mmaps[j].len) {
+			char *page = addr - (size_t)(addr - mmaps[j].start) % page_size;
+			if (mmap(page, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+				 -1, 0) != MAP_FAILED) {
+				mmaps[j].faulted = 1;
+				return;
+			}
+			break;
+		}
+	}
+
+	/* Not ours, so put back the old handler and let the fault repeat. */
+	sigaction(SIGBUS, &old_sigbus_action, NULL);
+}
+
+static int mmap_slot(char *start)
+{
+	int j;
+
+	for (j = 0; j < MAX_MMAPS; j++) {
+		if (mmaps[j].start == start)
+			return j;
+	}
+
+	return -1;
+}
+
+/* Map the whole file, if we can.  The map stays read()-based if not. */
+static void mmap_file(struct map_struct *map)
+{
+	static int handler_set = 0;
+	int j;
+	char *p;
+
+	if ((OFF_T)(size_t)map->file_size != map->file_size
+	 || (j = mmap_slot(NULL)) < 0)
+		return;
+
+	if (!handler_set) {
+		struct sigaction act;
+		memset(&act, 0, sizeof act);
+		act.sa_sigaction = mmap_sigbus_handler;
+		act.sa_flags = SA_SIGINFO;
+		sigemptyset(&act.sa_mask);
+		if (sigaction(SIGBUS, &act, &old_sigbus_action) < 0)
+			return;
+		page_size = sysconf(_SC_PAGESIZE);
+		handler_set = 1;
+	}
+
+	p = mmap(NULL, (size_t)map->file_size, PROT_READ, MAP_SHARED, map->fd, 0);
+	if (p == MAP_FAILED)
+		return;
+#ifdef HAVE_MADVISE
+	madvise(p, (size_t)map->file_size, MADV_SEQUENTIAL);
+#endif
+
+	mmaps[j].faulted = 0;
+	mmaps[j].len = (size_t)map->file_size;
+	mmaps[j].start = map->mmap_base = p;
+}
+
+static void mmap_release(struct map_struct *map)
+{
+	int j = mmap_slot(map->mmap_base);
+
+	if (mmaps[j].faulted && !map->status)
+		map->status = ENODATA;
+	mmaps[j].start = NULL;
+	munmap(map->mmap_base, mmaps[j].len);
+	map->mmap_base = NULL;
+	map->p = NULL;
+	map->p_offset = 0;
+	map->p_len = 0;
+}
+
+static void touch_range(const char *start, const char *end)
+{
+	const char *p;
+
+	for (p = start; p < end; p = (const char *)((size_t)p | (page_size - 1)) + 1)
+		touch_sum += *(volatile const char *)p;
+}
+
+/* Touch every page from start to start+len.  Returns 0 if the file no
+ * longer has some of them. */
+static int touch_pages(const char *start, int32 len)
+{
+	touch_start = start;
+	touch_end = start + len;
+
+	if (sigsetjmp(touch_jmp, 1))
+		return 0;
+
+	touch_range(touch_start, touch_end);
+	touch_start = touch_end = NULL;
+
+	return 1;
+}
+
+/* Slide the window along an mmap()ed file, which just means checking that
+ * the window's pages are there.  There is no copying.  Returns NULL if the
+ * file got truncated, in which case the map has gone back to read(). */
+static char *mmap_window(struct map_struct *map, OFF_T offset, int32 len)
+{
+	int32 window_size = map->def_window_size;
+	struct timeval tv;
+	int ok;
+
+	if (offset + window_size > map->file_size)
+		window_size = (int32)(map->file_size - offset);
+	if (len > window_size)
+		window_size = len;
+
+	start_read_wait(&tv);
+	ok = offset + window_size <= map->file_size
+	  && touch_pages(map->mmap_base + offset, window_size);
+	add_read_wait(&tv);
+
+	if (!ok) {
+		if (!map->status)
+			map->status = ENODATA;
+		mmap_release(map);
+		return NULL;
+	}
+
+#ifdef HAVE_MADVISE
+	if (offset + window_size < map->file_size) {
+		/* Ask for the next window to be read in while we use this one. */
+		char *next = map->mmap_base + offset + window_size;
+		char *page = next - (size_t)(next - map->mmap_base) % page_size;
+		size_t ahead = MIN((size_t)window_size,
+				   (size_t)(map->file_size - (page - map->mmap_base)));
+		madvise(page, ahead, MADV_WILLNEED);
+	}
+#endif
+
+	map->p = map->mmap_base + offset;
+	map->p_offset = offset;
+	map->p_len = window_size;
+
+	return map->p;
+}
+#endif
+
+/* Writing from a mapped page that the file no longer has fails with
+ * EFAULT (instead of raising a SIGBUS).  If buf is in one of our maps, its
+ * pages get touched, which has the SIGBUS handler put zeros in place of
+ * the missing ones (and note the error for the file), so that the write
+ * can be tried again.  Returns 0 if buf isn't ours. */
+int mmap_fault_in(const char *buf, size_t len)
+{
+#ifdef SUPPORT_MMAP
+	int j;
+
+	for (j = 0; j < MAX_MMAPS; j++) {
+		const char *start = mmaps[j].start, *end = start + mmaps[j].len;
+		if (start && buf >= start && buf < end) {
+			touch_range(buf, buf + len < end ? buf + len : end);
+			return 1;
+		}
+	}
+#endif
+	return 0;
+}
+
+#ifdef SUPPORT_PREFETCH
+/* With --prefetch, a reader thread reads the window that follows the one
+ * that map_ptr() just set up, so the data is (usually) already in memory
+ * when map_ptr() moves on to it.  There is just one request at a time,
+ * since a process only reads one file at a time. */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct map_struct *map;	/* the map the request is for (or NULL) */
+	int fd;
+	OFF_T offset;
+	int32 size, got;
+	int busy;		/* the thread has a request to read */
+	char *buf;
+	int32 alloc;
+} pf = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	 NULL, -1, 0, 0, 0, 0, NULL, 0 };
+
+static void *prefetch_main(UNUSED(void *ptr))
+{
+	int32 got, size;
+	ssize_t n;
+	OFF_T offset;
+	char *buf;
+	int fd;
+
+	pthread_mutex_lock(&pf.lock);
+	while (1) {
+		while (!pf.busy)
+			pthread_cond_wait(&pf.cond, &pf.lock);
+		fd = pf.fd;
+		offset = pf.offset;
+		size = pf.size;
+		buf = pf.buf;
+		pthread_mutex_unlock(&pf.lock);
+
+		for (got = 0; got < size; got += n) {
+			if ((n = pread(fd, buf + got, size - got, offset + got)) <= 0)
+				break;
+		}
+
+		pthread_mutex_lock(&pf.lock);
+		pf.got = got;
+		pf.busy = 0;
+		pthread_cond_broadcast(&pf.cond);
+	}
+
+	return NULL;
+}
+
+static int start_prefetch(void)
+{
+	static int started = 0;
+	sigset_t all, old;
+	pthread_t tid;
+
+	if (started)
+		return started > 0;
+
+	/* As with the checksum threads, only a SIGBUS gets through. */
+	sigfillset(&all);
+	sigdelset(&all, SIGBUS);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&tid, NULL, prefetch_main, NULL) != 0) {
+		rsyserr(FWARNING, errno, "unable to start the prefetch thread");
+		started = -1;
+	} else {
+		pthread_detach(tid);
+		started = 1;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return started > 0;
+}
+
+/* Ask the thread to read size bytes at offset.  Returns 0 if it can't. */
+static int prefetch_queue(struct map_struct *map, OFF_T offset, int32 size)
+{
+	if (!start_prefetch())
+		return 0;
+
+	pthread_mutex_lock(&pf.lock);
+	if (pf.busy) {
+		pthread_mutex_unlock(&pf.lock);
+		return 0;
+	}
+	if (size > pf.alloc) {
+		if (!(pf.buf = realloc_array(pf.buf, char, size)))
+			out_of_memory("prefetch_queue");
+		pf.alloc = size;
+	}
+	pf.map = map;
+	pf.fd = map->fd;
+	pf.offset = offset;
+	pf.size = size;
+	pf.got = 0;
+	pf.busy = 1;
+	pthread_cond_broadcast(&pf.cond);
+	pthread_mutex_unlock(&pf.lock);
+
+	return 1;
+}
+
+/* Copy whatever the thread read for us that starts at offset (waiting
+ * for it, if it's still reading).  Returns how many bytes were copied. */
+static int32 prefetch_take(struct map_struct *map, OFF_T offset, char *dest, int32 len)
+{
+	int32 n = 0;
+
+	pthread_mutex_lock(&pf.lock);
+	if (pf.map == map && offset >= pf.offset && offset < pf.offset + pf.size) {
+		if (pf.busy) {
+			struct timeval tv;
+			start_read_wait(&tv);
+			while (pf.busy)
+				pthread_cond_wait(&pf.cond, &pf.lock);
+			add_read_wait(&tv);
+		}
+		if (offset < pf.offset + pf.got) {
+			n = (int32)MIN((OFF_T)len, pf.offset + pf.got - offset);
+			memcpy(dest, pf.buf + (offset - pf.offset), n);
+		}
+	}
+	pthread_mutex_unlock(&pf.lock);
+
+	return n;
+}
+
+/* The map is going away, so make sure the thread is done with its fd. */
+static void prefetch_forget(struct map_struct *map)
+{
+	pthread_mutex_lock(&pf.lock);
+	if (pf.map == map) {
+		while (pf.busy)
+			pthread_cond_wait(&pf.cond, &pf.lock);
+		pf.map = NULL;
+	}
+	pthread_mutex_unlock(&pf.lock);
+}
+#endif
+
+#ifdef SEEK_HOLE
+/* With --sparse, map_ptr() asks the filesystem where the holes are, so that
+ * it doesn't have to read their zeros (which matters for a big, mostly empty
+ * disk image).  Returns how many of the len bytes at offset are in a hole,
+ * or 0 if offset is in the data, in which case *data_len_p is cut down so
+ * that the read stops at the next hole. */
+static int32 find_hole(struct map_struct *map, OFF_T offset, int32 len,
+		       int32 *data_len_p)
+{
+	if (offset < map->hole_from || offset >= map->hole_end) {
+		OFF_T start = do_lseek(map->fd, offset, SEEK_HOLE), end;
+		map->p_fd_offset = -1;
+		if (start < 0) {
+			/* The filesystem can't tell us, or the file shrank. */
+			map->find_holes = 0;
+			return 0;
+		}
+		if (start >= map->file_size)
+			start = end = map->file_size;
+		else if ((end = do_lseek(map->fd, start, SEEK_DATA)) < 0)
+			end = map->file_size; /* ENXIO: it's a hole to the end */
+		map->hole_from = offset;
+		map->hole_start = start;
+		map->hole_end = end;
+	}
+
+	if (offset >= map->hole_start)
+		return (int32)MIN((OFF_T)len, map->hole_end - offset);
+	if (map->hole_start - offset < len)
+		*data_len_p = (int32)(map->hole_start - offset);
+
+	return 0;
+}
+#endif
+
+/* With --drop-cache, tell the kernel that we're done with the part of the
+ * file before upto (or all of it, if upto is -1), so that reading a big
+ * file doesn't push everything else out of the page cache.  This is done
+ * in steps of DROP_CACHE_STEP, to keep down the number of system calls. */
+static void drop_read_cache(struct map_struct *map, OFF_T upto)
+{
+#ifdef HAVE_POSIX_FADVISE
+	if (upto < 0)
+		posix_fadvise(map->fd, 0, 0, POSIX_FADV_DONTNEED);
+	else if (upto >= map->dropped + DROP_CACHE_STEP) {
+		posix_fadvise(map->fd, map->dropped, upto - map->dropped,
+			      POSIX_FADV_DONTNEED);
+		map->dropped = upto;
+	}
+#endif
+}
+
+#ifdef SUPPORT_DIRECT_IO
+/* Grow the aligned window buffer of an O_DIRECT map, keeping its data. */
+static void grow_direct_window(struct map_struct *map, int32 size)
+{
+	void *p;
+
+	if (posix_memalign(&p, DIRECT_IO_ALIGN, size) != 0)
+		out_of_memory("map_ptr");
+	if (map->p) {
+		memcpy(p, map->p, map->p_len);
+		free(map->p);
+	}
+	map->p = p;
+	map->p_size = size;
+}
+#endif
+
+/* Get the window after the current one on its way in from the disk. */
+static void read_ahead(struct map_struct *map)
+{
+	OFF_T next = map->p_offset + map->p_len;
+	int32 size;
+
+	if (next >= map->file_size)
+		return;
+	size = (int32)MIN(map->file_size - next, (OFF_T)map->def_window_size);
+
+#ifdef SUPPORT_PREFETCH
+	if (use_prefetch && prefetch_queue(map, next, size))
+		return;
+#endif
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(map->fd, next, size, POSIX_FADV_WILLNEED);
+#endif
+}
+
+/* This gives sliding window access to a file, somewhat like mmap() but
+ * using read().  The read() is the default because another program (such
+ * as a mailer) truncating the file would give an mmap() user a SIGBUS.
+ * The --mmap option maps the file instead (see above), which saves the
+ * copying of each window. */
 struct map_struct *map_file(int fd, OFF_T len, int32 read_size,
 			    int32 blk_size)
 {
@@ -169,6 +1039,22 @@ struct map_struct *map_file(int fd, OFF_T len, int32 read_size,
 	map->file_size = len;
 	map->def_window_size = read_size;
 
+#ifdef SUPPORT_MMAP
+	if (use_mmap && len > 0)
+		mmap_file(map);
+#endif
+#ifdef SUPPORT_DIRECT_IO
+	if (direct_io_min && len >= direct_io_min && !map->mmap_base)
+		map->direct = set_direct_io(fd, 1) == 0;
+#endif
+#ifdef SEEK_HOLE
+	map->find_holes = sparse_files > 0 && !map->mmap_base && !map->direct;
+#endif
+#ifdef HAVE_POSIX_FADVISE
+	if (!map->mmap_base && !map->direct && len > 0)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
 	return map;
 }
 
@@ -192,9 +1078,25 @@ char *map_ptr(struct map_struct *map, OFF_T offset, int32 len)
 	if (offset >= map->p_offset && offset+len <= map->p_offset+map->p_len)
 		return map->p + (offset - map->p_offset);
 
+#ifdef SUPPORT_MMAP
+	if (map->mmap_base) {
+		char *ptr = mmap_window(map, offset, len);
+		if (ptr)
+			return ptr;
+	}
+#endif
+
 	/* nope, we are going to have to do a read. Work out our desired window */
 	window_start = offset;
 	window_size = map->def_window_size;
+#ifdef SUPPORT_DIRECT_IO
+	if (map->direct) {
+		/* O_DIRECT reads whole blocks into an aligned buffer. */
+		window_start -= offset % DIRECT_IO_ALIGN;
+		window_size = MAX(window_size, (int32)(offset - window_start) + len);
+		window_size = DIRECT_ALIGN(window_size);
+	}
+#endif
 	if (window_start + window_size > map->file_size)
 		window_size = (int32)(map->file_size - window_start);
 	if (len > window_size)
@@ -202,10 +1104,17 @@ char *map_ptr(struct map_struct *map, OFF_T offset, int32 len)
 
 	/* make sure we have allocated enough memory for the window */
 	if (window_size > map->p_size) {
-		map->p = realloc_array(map->p, char, window_size);
-		if (!map->p)
-			out_of_memory("map_ptr");
-		map->p_size = window_size;
+#ifdef SUPPORT_DIRECT_IO
+		if (map->direct)
+			grow_direct_window(map, DIRECT_ALIGN(window_size));
+		else
+#endif
+		{
+			map->p = realloc_array(map->p, char, window_size);
+			if (!map->p)
+				out_of_memory("map_ptr");
+			map->p_size = window_size;
+		}
 	}
 
 	/* Now try to avoid re-reading any bytes by reusing any bytes
@@ -229,34 +1138,82 @@ char *map_ptr(struct map_struct *map, OFF_T offset, int32 len)
 		exit_cleanup(RERR_FILEIO);
 	}
 
-	if (map->p_fd_offset != read_start) {
-		OFF_T ret = do_lseek(map->fd, read_start, SEEK_SET);
-		if (ret != read_start) {
-			rsyserr(FERROR, errno, "lseek returned %.0f, not %.0f",
-				(double)ret, (double)read_start);
-			exit_cleanup(RERR_FILEIO);
-		}
-		map->p_fd_offset = read_start;
-	}
 	map->p_offset = window_start;
 	map->p_len = window_size;
 
-	while (read_size > 0) {
-		nread = read(map->fd, map->p + read_offset, read_size);
-		if (nread <= 0) {
-			if (!map->status)
-				map->status = nread ? errno : ENODATA;
-			/* The best we can do is zero the buffer -- the file
-			 * has changed mid transfer! */
-			memset(map->p + read_offset, 0, read_size);
-			break;
-		}
-		map->p_fd_offset += nread;
+#ifdef SUPPORT_PREFETCH
+	if (use_prefetch) {
+		nread = prefetch_take(map, read_start, map->p + read_offset, read_size);
+		read_start += nread;
 		read_offset += nread;
 		read_size -= nread;
 	}
+#endif
 
-	return map->p;
+	if (read_size > 0) {
+		struct timeval tv;
+
+		start_read_wait(&tv);
+		while (read_size > 0) {
+			int32 chunk = read_size;
+#ifdef SEEK_HOLE
+			if (map->find_holes
+			 && (nread = find_hole(map, read_start, read_size, &chunk)) > 0) {
+				memset(map->p + read_offset, 0, nread);
+				read_start += nread;
+				read_offset += nread;
+				read_size -= nread;
+				continue;
+			}
+#endif
+			if (map->p_fd_offset != read_start) {
+				OFF_T ret = do_lseek(map->fd, read_start, SEEK_SET);
+				if (ret != read_start) {
+					rsyserr(FERROR, errno, "lseek returned %.0f, not %.0f",
+						(double)ret, (double)read_start);
+					exit_cleanup(RERR_FILEIO);
+				}
+				map->p_fd_offset = read_start;
+			}
+#ifdef SUPPORT_DIRECT_IO
+			if (map->direct) {
+				/* The read can go past EOF, but not past p_size. */
+				nread = read(map->fd, map->p + read_offset, DIRECT_ALIGN(chunk));
+				if (nread < 0 && errno == EINVAL) {
+					/* It won't take O_DIRECT after all. */
+					set_direct_io(map->fd, 0);
+					map->direct = 0;
+					continue;
+				}
+				if (nread > read_size)
+					nread = read_size;
+			} else
+#endif
+			nread = read(map->fd, map->p + read_offset, chunk);
+			if (nread <= 0) {
+				if (!map->status)
+					map->status = nread ? errno : ENODATA;
+				/* The best we can do is zero the buffer -- the file
+				 * has changed mid transfer! */
+				memset(map->p + read_offset, 0, read_size);
+				break;
+			}
+			map->p_fd_offset += nread;
+			read_start += nread;
+			read_offset += nread;
+			read_size -= nread;
+		}
+		add_read_wait(&tv);
+	}
+
+	if (map->direct)
+		return map->p + (offset - map->p_offset);
+
+	if (drop_cache)
+		drop_read_cache(map, map->p_offset);
+	read_ahead(map);
+
+	return map->p + (offset - map->p_offset);
 }
 
 
@@ -264,6 +1221,15 @@ int unmap_file(struct map_struct *map)
 {
 	int	ret;
 
+#ifdef SUPPORT_MMAP
+	if (map->mmap_base)
+		mmap_release(map);
+#endif
+#ifdef SUPPORT_PREFETCH
+	prefetch_forget(map);
+#endif
+	if (drop_cache && !map->direct)
+		drop_read_cache(map, -1);
 	if (map->p) {
 		free(map->p);
 		map->p = NULL;
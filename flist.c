@@ -34,6 +34,7 @@ extern int am_generator;
 extern int inc_recurse;
 extern int do_progress;
 extern int always_checksum;
+extern int checksum_cache;
 extern int module_id;
 extern int ignore_errors;
 extern int numeric_ids;
@@ -1299,8 +1300,12 @@ struct file_struct *make_file(const char *fname, struct file_list *flist,
 		memcpy(bp + basename_len, linkname, linkname_len);
 #endif
 
-	if (always_checksum && am_sender && S_ISREG(st.st_mode))
-		file_checksum(thisname, tmp_sum, st.st_size);
+	if (always_checksum && am_sender && S_ISREG(st.st_mode)) {
+		if (checksum_cache)
+			cached_file_checksum(thisname, &st, tmp_sum);
+		else
+			file_checksum(thisname, tmp_sum, st.st_size);
+	}
 
 	if (am_sender)
 		F_PATHNAME(file) = pathname;
@@ -74,7 +74,11 @@ extern int protocol_version;
 extern int file_total;
 extern int fuzzy_basis;
 extern int always_checksum;
+extern int checksum_cache;
 extern int checksum_len;
+extern int checksum_threads;
+extern int cdc_mode;
+extern int adaptive_block_size;
 extern char *partial_dir;
 extern char *basis_dir[MAX_BASIS_DIRS+1];
 extern int compare_dest;
@@ -724,7 +728,10 @@ int unchanged_file(char *fn, struct file_struct *file, STRUCT_STAT *st)
 	   of the file time to determine whether to sync */
 	if (always_checksum > 0 && S_ISREG(st->st_mode)) {
 		char sum[MAX_DIGEST_LEN];
-		file_checksum(fn, sum, st->st_size);
+		if (checksum_cache)
+			cached_file_checksum(fn, st, sum);
+		else
+			file_checksum(fn, sum, st->st_size);
 		return memcmp(sum, F_SUM(file), checksum_len) == 0;
 	}
 
@@ -738,6 +745,137 @@ int unchanged_file(char *fn, struct file_struct *file, STRUCT_STAT *st)
 }
 
 
+/* With --adaptive-block-size, we remember how the files with each suffix
+ * changed during the earlier transfers of this run: how many bytes the
+ * updated files held, and how many runs of literal data the sender had to
+ * send for them (which is about how many separate changes there were). */
+struct block_history {
+	char suffix[16];
+	int64 bytes;
+	int64 runs;
+};
+
+#define MIN_HISTORY_BYTES ((int64)BLOCK_SIZE * BLOCK_SIZE)
+
+static struct block_history *block_hist;
+static int block_hist_cnt, block_hist_alloc;
+
+static struct block_history *find_block_history(const char *name, int create)
+{
+	const char *dot = strrchr(name, '.');
+	const char *suffix = dot && dot != name ? dot + 1 : "";
+	int j;
+
+	if (strlen(suffix) >= sizeof block_hist->suffix)
+		suffix = "";
+
+	for (j = 0; j < block_hist_cnt; j++) {
+		if (strcasecmp(block_hist[j].suffix, suffix) == 0)
+			return &block_hist[j];
+	}
+
+	if (!create)
+		return NULL;
+
+	if (block_hist_cnt == block_hist_alloc) {
+		block_hist_alloc = block_hist_alloc ? block_hist_alloc * 2 : 16;
+		block_hist = realloc_array(block_hist, struct block_history,
+					   block_hist_alloc);
+		if (!block_hist)
+			out_of_memory("find_block_history");
+	}
+	memset(&block_hist[j], 0, sizeof block_hist[j]);
+	strlcpy(block_hist[j].suffix, suffix, sizeof block_hist[j].suffix);
+	block_hist_cnt++;
+
+	return &block_hist[j];
+}
+
+/* The receiver tells us how many literal runs it got for file ndx. */
+void note_literal_runs(int ndx, int32 runs)
+{
+	struct file_list *flist = flist_for_ndx(ndx, "note_literal_runs");
+	struct file_struct *file = flist->files[ndx - flist->ndx_start];
+	struct block_history *h = find_block_history(file->basename, 1);
+
+	h->bytes += F_LENGTH(file);
+	h->runs += runs;
+}
+
+/* Return the largest multiple of 8 (but at least BLOCK_SIZE) whose square
+ * is no more than n. */
+static int32 sqrt_blength(int64 n, int32 max_blength)
+{
+	int32 blength, c;
+	int64 l;
+
+	for (c = 1, l = n; l >>= 2; c <<= 1) {}
+	if (c < 0 || c >= max_blength)
+		return max_blength;
+	blength = 0;
+	do {
+		blength |= c;
+		if (n < (int64)blength * blength)
+			blength &= ~c;
+		c >>= 1;
+	} while (c >= 8);	/* round to multiple of 8 */
+
+	return MAX(blength, BLOCK_SIZE);
+}
+
+/* The block size is a rounded square root of file length (unless the user
+ * forced a size). */
+int32 default_block_size(int64 len)
+{
+	if (block_size)
+		return block_size;
+	if (len <= BLOCK_SIZE * BLOCK_SIZE)
+		return BLOCK_SIZE;
+	return sqrt_blength(len, protocol_version < 30 ? OLD_MAX_BLOCK_SIZE : MAX_BLOCK_SIZE);
+}
+
+/* Pick a block size from the history of the file's suffix.  Each block
+ * costs sum_len bytes of checksums (and the work to make and look them
+ * up), and each change in the file costs about a block of literal data,
+ * so the total is smallest when the block size is the square root of
+ * sum_len times the bytes per change.  Returns 0 if there isn't enough
+ * history to go on. */
+static int32 adapted_block_size(struct file_struct *file, int s2length)
+{
+	struct block_history *h = find_block_history(file->basename, 0);
+
+	if (!h || h->bytes < MIN_HISTORY_BYTES)
+		return 0;
+
+	/* Counting one extra run keeps us from going straight to the
+	 * biggest blocks when no changes have been seen yet. */
+	return sqrt_blength((4 + s2length) * h->bytes / (h->runs + 1),
+			    protocol_version < 30 ? OLD_MAX_BLOCK_SIZE : MAX_BLOCK_SIZE);
+}
+
+static int sum2_length(int64 len, int32 blength)
+{
+	int s2length;
+
+	if (protocol_version < 27) {
+		s2length = csum_length;
+	} else if (csum_length == SUM_LENGTH) {
+		s2length = SUM_LENGTH;
+	} else {
+		int32 c;
+		int64 l;
+		int b = BLOCKSUM_BIAS;
+		for (l = len; l >>= 1; b += 2) {}
+		for (c = blength; (c >>= 1) && b; b--) {}
+		/* add a bit, subtract rollsum, round up. */
+		s2length = (b + 1 - 32 + 7) / 8; /* --optimize in compiler-- */
+		s2length = MAX(s2length, csum_length);
+		s2length = MIN(s2length, SUM_LENGTH);
+	}
+
+	return MIN(s2length, checksum_digest_len());
+}
+
 /*
  * set (initialize) the size entries in the per-file sum_struct
  * calculating dynamic block and checksum sizes.
@@ -745,19 +883,19 @@ int unchanged_file(char *fn, struct file_struct *file, STRUCT_STAT *st)
  * This is only called from generate_and_send_sums() but is a separate
  * function to encapsulate the logic.
  *
- * The block size is a rounded square root of file length.
+ * The block size is a rounded square root of file length, unless
+ * --adaptive-block-size has some history for the file's suffix.
  *
  * The checksum size is determined according to:
  *     blocksum_bits = BLOCKSUM_BIAS + 2*log2(file_len) - log2(block_len)
  * provided by Donovan Baarda which gives a probability of rsync
  * algorithm corrupting data and falling back using the whole md4
  * checksums.
- *
- * This might be made one of several selectable heuristics.
  */
-static void sum_sizes_sqroot(struct sum_struct *sum, int64 len)
+static void sum_sizes_sqroot(struct sum_struct *sum, int64 len,
+			     struct file_struct *file)
 {
-	int32 blength;
+	int32 blength, adapted;
 	int s2length;
 	int64 l;
 
@@ -767,42 +905,19 @@ static void sum_sizes_sqroot(struct sum_struct *sum, int64 len)
 		return;
 	}
 
-	if (block_size)
-		blength = block_size;
-	else if (len <= BLOCK_SIZE * BLOCK_SIZE)
-		blength = BLOCK_SIZE;
-	else {
-		int32 max_blength = protocol_version < 30 ? OLD_MAX_BLOCK_SIZE : MAX_BLOCK_SIZE;
-		int32 c;
-		int cnt;
-		for (c = 1, l = len, cnt = 0; l >>= 2; c <<= 1, cnt++) {}
-		if (c < 0 || c >= max_blength)
-			blength = max_blength;
-		else {
-		    blength = 0;
-		    do {
-			    blength |= c;
-			    if (len < (int64)blength * blength)
-				    blength &= ~c;
-			    c >>= 1;
-		    } while (c >= 8);	/* round to multiple of 8 */
-		    blength = MAX(blength, BLOCK_SIZE);
-		}
-	}
+	blength = default_block_size(len);
+	s2length = sum2_length(len, blength);
 
-	if (protocol_version < 27) {
-		s2length = csum_length;
-	} else if (csum_length == SUM_LENGTH) {
-		s2length = SUM_LENGTH;
-	} else {
-		int32 c;
-		int b = BLOCKSUM_BIAS;
-		for (l = len; l >>= 1; b += 2) {}
-		for (c = blength; (c >>= 1) && b; b--) {}
-		/* add a bit, subtract rollsum, round up. */
-		s2length = (b + 1 - 32 + 7) / 8; /* --optimize in compiler-- */
-		s2length = MAX(s2length, csum_length);
-		s2length = MIN(s2length, SUM_LENGTH);
+	if (adaptive_block_size && !block_size
+	 && (adapted = adapted_block_size(file, s2length)) != 0
+	 && adapted != blength) {
+		if (verbose > 2) {
+			rprintf(FINFO, "adapted blength for %s: %ld (was %ld)\n",
+				f_name(file, NULL), (long)adapted, (long)blength);
+		}
+		blength = adapted;
+		s2length = sum2_length(len, blength);
+		stats.adapted_block_files++;
 	}
 
 	sum->flength	= len;
@@ -823,19 +938,137 @@ static void sum_sizes_sqroot(struct sum_struct *sum, int64 len)
 }
 
 
+/* How many bytes of the basis file each checksum thread gets per batch. */
+#define THREAD_BATCH_SIZE (1024*1024)
+
+struct sum_batch {
+	char *map;	/* the mapped data for the batch's blocks */
+	int32 blength;	/* the length of each block in the batch */
+	int cnt;	/* the number of blocks in the batch */
+	uint32 *sum1;
+	char *sum2;	/* cnt SUM_LENGTH-sized strong sums */
+};
+
+/* Checksum this worker's share of the blocks in a batch. */
+static void checksum_blocks(void *arg, int ndx, int nthreads)
+{
+	struct sum_batch *b = (struct sum_batch *)arg;
+	int from = (int)((int64)b->cnt * ndx / nthreads);
+	int to = (int)((int64)b->cnt * (ndx + 1) / nthreads);
+	char *bufs[CSUM2_LANES], *sums[CSUM2_LANES];
+	int i, j, cnt;
+
+	for (i = from; i < to; i += cnt) {
+		cnt = MIN(to - i, CSUM2_LANES);
+		for (j = 0; j < cnt; j++) {
+			bufs[j] = b->map + (int64)(i + j) * b->blength;
+			sums[j] = b->sum2 + (i + j) * SUM_LENGTH;
+			b->sum1[i + j] = get_checksum1(bufs[j], b->blength);
+		}
+		get_checksum2_multi(bufs, b->blength, cnt, sums);
+	}
+}
+
+/* With --cdc, the basis file is cut into content-defined chunks instead of
+ * fixed-size blocks (see cdc.c), and each chunk's length is sent ahead of
+ * its sums.  The sum head's blength is the average chunk size, which the
+ * sender uses to cut up its own file the same way. */
+static int generate_and_send_cdc_sums(int fd, OFF_T len, int f_out, int f_copy,
+				      struct file_struct *file)
+{
+	static struct cdc_sum {
+		int32 len;
+		uint32 sum1;
+		char sum2[SUM_LENGTH];
+	} *sums;
+	static int32 sums_alloc;
+	struct map_struct *mapbuf;
+	struct sum_struct sum;
+	struct cdc_sum *cs;
+	OFF_T offset;
+	char *map;
+	int32 i;
+
+	sum_sizes_sqroot(&sum, len, file);
+	if (sum.count < 0)
+		return -1;
+	sum.blength = cdc_avg_size(sum.blength);
+	sum.remainder = 0;
+
+	if (len > 0)
+		mapbuf = map_file(fd, len, MAX_MAP_SIZE, sum.blength);
+	else
+		mapbuf = NULL;
+
+	/* The chunk count has to be sent first, so the chunks and their sums
+	 * are all found (in one pass over the file) before any get sent. */
+	for (i = 0, offset = 0; offset < len; i++, offset += cs->len) {
+		if (i == sums_alloc) {
+			sums_alloc = sums_alloc ? sums_alloc * 2 : 1024;
+			if (!(sums = realloc_array(sums, struct cdc_sum, sums_alloc)))
+				out_of_memory("generate_and_send_cdc_sums");
+		}
+		cs = &sums[i];
+		cs->len = cdc_chunk_len(mapbuf, offset, len - offset, sum.blength);
+		map = map_ptr(mapbuf, offset, cs->len);
+
+		if (f_copy >= 0)
+			full_write(f_copy, map, cs->len);
+
+		cs->sum1 = get_checksum1(map, cs->len);
+		get_checksum2(map, cs->len, cs->sum2);
+	}
+	sum.count = i;
+
+	if (verbose > 2) {
+		rprintf(FINFO, "cdc count=%ld avg=%ld\n",
+			(long)sum.count, (long)sum.blength);
+	}
+
+	write_sum_head(f_out, &sum);
+
+	for (i = 0, offset = 0; i < sum.count; offset += sums[i++].len) {
+		cs = &sums[i];
+		if (verbose > 3) {
+			rprintf(FINFO,
+				"chunk[%.0f] offset=%.0f len=%ld sum1=%08lx\n",
+				(double)i, (double)offset, (long)cs->len,
+				(unsigned long)cs->sum1);
+		}
+		write_varint(f_out, cs->len);
+		write_int(f_out, cs->sum1);
+		write_buf(f_out, cs->sum2, sum.s2length);
+	}
+
+	if (mapbuf)
+		unmap_file(mapbuf);
+
+	return 0;
+}
+
 /*
  * Generate and send a stream of signatures/checksums that describe a buffer
  *
  * Generate approximately one checksum every block_len bytes.
+ *
+ * The full-size blocks are checksummed in batches, which are split up
+ * among the --checksum-threads workers.  The sums are always written out
+ * in block order, so the threads have no effect on what the sender sees.
  */
-static int generate_and_send_sums(int fd, OFF_T len, int f_out, int f_copy)
+static int generate_and_send_sums(int fd, OFF_T len, int f_out, int f_copy,
+				  struct file_struct *file)
 {
-	int32 i;
+	int32 i, max_cnt;
+	int j, nthreads;
 	struct map_struct *mapbuf;
 	struct sum_struct sum;
+	struct sum_batch batch;
 	OFF_T offset = 0;
 
-	sum_sizes_sqroot(&sum, len);
+	if (cdc_mode)
+		return generate_and_send_cdc_sums(fd, len, f_out, f_copy, file);
+
+	sum_sizes_sqroot(&sum, len, file);
 	if (sum.count < 0)
 		return -1;
 	write_sum_head(f_out, &sum);
@@ -848,32 +1081,68 @@ static int generate_and_send_sums(int fd, OFF_T len, int f_out, int f_copy)
 	else
 		mapbuf = NULL;
 
-	for (i = 0; i < sum.count; i++) {
-		int32 n1 = (int32)MIN(len, (OFF_T)sum.blength);
-		char *map = map_ptr(mapbuf, offset, n1);
-		char sum2[SUM_LENGTH];
-		uint32 sum1;
+	/* (We're also copying the data when f_copy >= 0, which we do 1 block
+	 * at a time.) */
+	if (f_copy >= 0)
+		max_cnt = 1;
+	else if (checksum_threads > 1) {
+		max_cnt = (int32)MIN((int64)checksum_threads * THREAD_BATCH_SIZE / sum.blength,
+				     sum.count);
+		max_cnt = MAX(max_cnt, CSUM2_LANES);
+	} else
+		max_cnt = CSUM2_LANES;
+
+	if (max_cnt <= CSUM2_LANES) {
+		static uint32 sum1_buf[CSUM2_LANES];
+		static char sum2_buf[CSUM2_LANES * SUM_LENGTH];
+		batch.sum1 = sum1_buf;
+		batch.sum2 = sum2_buf;
+	} else {
+		if (!(batch.sum1 = new_array(uint32, max_cnt))
+		 || !(batch.sum2 = new_array(char, max_cnt * SUM_LENGTH)))
+			out_of_memory("generate_and_send_sums");
+	}
+
+	for (i = 0; i < sum.count; i += batch.cnt) {
+		batch.blength = (int32)MIN(len, (OFF_T)sum.blength);
+
+		/* The (short) final block always gets a batch to itself. */
+		if (batch.blength == sum.blength)
+			batch.cnt = (int)MIN(MIN(len / batch.blength, (OFF_T)max_cnt), sum.count - i);
+		else
+			batch.cnt = 1;
 
-		len -= n1;
-		offset += n1;
+		batch.map = map_ptr(mapbuf, offset, batch.blength * batch.cnt);
 
 		if (f_copy >= 0) {
-			full_write(f_copy, map, n1);
-			if (append_mode > 0)
+			full_write(f_copy, batch.map, batch.blength);
+			if (append_mode > 0) {
+				len -= batch.blength;
+				offset += batch.blength;
 				continue;
+			}
 		}
 
-		sum1 = get_checksum1(map, n1);
-		get_checksum2(map, n1, sum2);
+		nthreads = batch.cnt > CSUM2_LANES ? checksum_threads : 1;
+		run_workers(nthreads, checksum_blocks, &batch);
 
-		if (verbose > 3) {
-			rprintf(FINFO,
-				"chunk[%.0f] offset=%.0f len=%ld sum1=%08lx\n",
-				(double)i, (double)offset - n1, (long)n1,
-				(unsigned long)sum1);
+		for (j = 0; j < batch.cnt; j++) {
+			if (verbose > 3) {
+				rprintf(FINFO,
+					"chunk[%.0f] offset=%.0f len=%ld sum1=%08lx\n",
+					(double)(i + j), (double)offset, (long)batch.blength,
+					(unsigned long)batch.sum1[j]);
+			}
+			write_int(f_out, batch.sum1[j]);
+			write_buf(f_out, batch.sum2 + j * SUM_LENGTH, sum.s2length);
+			len -= batch.blength;
+			offset += batch.blength;
 		}
-		write_int(f_out, sum1);
-		write_buf(f_out, sum2, sum.s2length);
+	}
+
+	if (max_cnt > CSUM2_LANES) {
+		free(batch.sum1);
+		free(batch.sum2);
 	}
 
 	if (mapbuf)
@@ -1975,7 +2244,7 @@ static void recv_generator(char *fname, struct file_struct *file, int ndx,
 		write_sum_head(f_out, NULL);
 		close(fd);
 	} else {
-		if (generate_and_send_sums(fd, sx.st.st_size, f_out, f_copy) < 0) {
+		if (generate_and_send_sums(fd, sx.st.st_size, f_out, f_copy, file) < 0) {
 			rprintf(FWARNING,
 			    "WARNING: file is too large for checksum sending: %s\n",
 			    fnamecmp);
@@ -29,12 +29,23 @@
 
 #include "rsync.h"
 #include "ifuncs.h"
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#else
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#endif
 
 /** If no timeout is specified then use a 60 second select timeout */
 #define SELECT_TIMEOUT 60
 
-extern int bwlimit;
-extern size_t bwlimit_writemax;
+/* The most buffers that go out in one gathered write: a MSG_DATA header
+ * plus the output buffer, and the data that wouldn't fit in it. */
+#define MAX_OUT_IOVS 3
+
+extern int io_buffer_size;
 extern int io_timeout;
 extern int am_server;
 extern int am_daemon;
@@ -74,14 +85,16 @@ int sock_f_in = -1;
 int sock_f_out = -1;
 
 static int iobuf_f_in = -1;
-static char *iobuf_in;
+static char *iobuf_in; /* holds what we've read ahead from iobuf_f_in */
 static size_t iobuf_in_siz;
 static size_t iobuf_in_ndx;
 static size_t iobuf_in_remaining;
+static size_t iobuf_in_data; /* what's left of the current MSG_DATA */
 
 static int iobuf_f_out = -1;
-static char *iobuf_out;
+static char *iobuf_out; /* has room for a MSG_DATA header before it */
 static int iobuf_out_cnt;
+static int iobuf_out_siz;
 
 int flist_forward_from = -1;
 
@@ -144,6 +157,7 @@ static void check_timeout(void)
 static void readfd(int fd, char *buffer, size_t N);
 static void writefd(int fd, const char *buf, size_t len);
 static void writefd_unbuffered(int fd, const char *buf, size_t len);
+static void flush_iobuf_out(const char *buf, size_t len);
 static void mplex_write(int fd, enum msgcode code, const char *buf, size_t len, int convert);
 
 static flist_ndx_list redo_list, hlink_list;
@@ -409,6 +423,12 @@ static void read_msg_fd(void)
 		readfd(fd, buf, 4);
 		got_flist_entry_status(FES_NO_SEND, buf);
 		break;
+	case MSG_LITERAL_RUNS:
+		if (len != 8 || !am_generator)
+			goto invalid_msg;
+		readfd(fd, buf, 8);
+		note_literal_runs(IVAL(buf, 0), IVAL(buf, 4));
+		break;
 	case MSG_ERROR_SOCKET:
 	case MSG_ERROR_UTF8:
 	case MSG_CLIENT:
@@ -615,43 +635,36 @@ static void whine_about_eof(int fd)
 static int read_timeout(int fd, char *buf, size_t len)
 {
 	int n, cnt = 0;
+	/* Our (nonblocking) socket gets read before we wait on it, unless
+	 * there's files-from data to shuttle. */
+	int try_read = (fd == sock_f_in || fd == msg_fd_in)
+		    && io_filesfrom_f_out < 0 && !read_batch;
 
 	io_flush(FULL_FLUSH);
 
 	while (cnt == 0) {
 		/* until we manage to read *something* */
-		fd_set r_fds, w_fds;
-		struct timeval tv;
-		int maxfd = fd;
 		int count;
 
-		FD_ZERO(&r_fds);
-		FD_ZERO(&w_fds);
-		FD_SET(fd, &r_fds);
+		if (try_read)
+			goto try_it;
+
+		evloop_add(fd, EVL_READ);
 		if (io_filesfrom_f_out >= 0) {
-			int new_fd;
 			if (ff_buf.len == 0) {
-				if (io_filesfrom_f_in >= 0) {
-					FD_SET(io_filesfrom_f_in, &r_fds);
-					new_fd = io_filesfrom_f_in;
-				} else {
+				if (io_filesfrom_f_in >= 0)
+					evloop_add(io_filesfrom_f_in, EVL_READ);
+				else
 					io_filesfrom_f_out = -1;
-					new_fd = -1;
-				}
-			} else {
-				FD_SET(io_filesfrom_f_out, &w_fds);
-				new_fd = io_filesfrom_f_out;
-			}
-			if (new_fd > maxfd)
-				maxfd = new_fd;
+			} else
+				evloop_add(io_filesfrom_f_out, EVL_WRITE);
 		}
 
-		tv.tv_sec = select_timeout;
-		tv.tv_usec = 0;
-
 		errno = 0;
 
-		count = select(maxfd + 1, &r_fds, &w_fds, NULL, &tv);
+		count = evloop_wait(select_timeout);
+		if (fd == sock_f_in)
+			stats.sock_wait_calls++;
 
 		if (count <= 0) {
 			if (errno == EBADF) {
@@ -664,7 +677,7 @@ static int read_timeout(int fd, char *buf, size_t len)
 
 		if (io_filesfrom_f_out >= 0) {
 			if (ff_buf.len) {
-				if (FD_ISSET(io_filesfrom_f_out, &w_fds)) {
+				if (evloop_ready(io_filesfrom_f_out) & EVL_WRITE) {
 					int l = write(io_filesfrom_f_out,
 						      ff_buf.buf + ff_buf.pos,
 						      ff_buf.len);
@@ -679,7 +692,7 @@ static int read_timeout(int fd, char *buf, size_t len)
 					}
 				}
 			} else if (io_filesfrom_f_in >= 0) {
-				if (FD_ISSET(io_filesfrom_f_in, &r_fds)) {
+				if (evloop_ready(io_filesfrom_f_in) & EVL_READ) {
 #ifdef ICONV_OPTION
 					xbuf *ibuf = filesfrom_convert ? &iconv_buf : &ff_buf;
 #else
@@ -739,17 +752,23 @@ static int read_timeout(int fd, char *buf, size_t len)
 			}
 		}
 
-		if (!FD_ISSET(fd, &r_fds))
+		if (!(evloop_ready(fd) & EVL_READ))
 			continue;
 
-		n = read(fd, buf, len);
+	  try_it:
+		n = read(fd, buf, fd == sock_f_in ? bwlimit_max_io(len) : len);
+		if (fd == sock_f_in)
+			stats.sock_read_calls++;
 
 		if (n <= 0) {
 			if (n == 0)
 				whine_about_eof(fd); /* Doesn't return. */
-			if (errno == EINTR || errno == EWOULDBLOCK
-			    || errno == EAGAIN)
+			if (errno == EINTR)
+				continue;
+			if (errno == EWOULDBLOCK || errno == EAGAIN) {
+				try_read = 0;
 				continue;
+			}
 
 			/* Don't write errors on a dead socket. */
 			if (fd == sock_f_in) {
@@ -764,8 +783,11 @@ static int read_timeout(int fd, char *buf, size_t len)
 		len -= n;
 		cnt += n;
 
-		if (fd == sock_f_in && io_timeout)
-			last_io_in = time(NULL);
+		if (fd == sock_f_in) {
+			if (io_timeout)
+				last_io_in = time(NULL);
+			bwlimit_account(BWL_IN, n);
+		}
 	}
 
 	return cnt;
@@ -793,18 +815,9 @@ int read_line(int fd, char *buf, size_t bufsiz, int flags)
 		cnt = read(fd, &ch, 1);
 		if (cnt < 0 && (errno == EWOULDBLOCK
 		  || errno == EINTR || errno == EAGAIN)) {
-			struct timeval tv;
-			fd_set r_fds, e_fds;
-			FD_ZERO(&r_fds);
-			FD_SET(fd, &r_fds);
-			FD_ZERO(&e_fds);
-			FD_SET(fd, &e_fds);
-			tv.tv_sec = select_timeout;
-			tv.tv_usec = 0;
-			if (!select(fd+1, &r_fds, NULL, &e_fds, &tv))
+			evloop_add(fd, EVL_READ);
+			if (!evloop_wait(select_timeout))
 				check_timeout();
-			/*if (FD_ISSET(fd, &e_fds))
-				rprintf(FINFO, "select exception on fd %d\n", fd); */
 			continue;
 		}
 		if (cnt != 1)
@@ -898,8 +911,10 @@ int io_start_buffering_out(int f_out)
 		assert(f_out == iobuf_f_out);
 		return 0;
 	}
-	if (!(iobuf_out = new_array(char, IO_BUFFER_SIZE)))
+	iobuf_out_siz = io_buffer_size ? io_buffer_size : IO_BUFFER_SIZE;
+	if (!(iobuf_out = new_array(char, 4 + iobuf_out_siz)))
 		out_of_memory("io_start_buffering_out");
+	iobuf_out += 4;
 	iobuf_out_cnt = 0;
 	iobuf_f_out = f_out;
 	return 1;
@@ -911,7 +926,9 @@ int io_start_buffering_in(int f_in)
 		assert(f_in == iobuf_f_in);
 		return 0;
 	}
-	iobuf_in_siz = 2 * IO_BUFFER_SIZE;
+	iobuf_in_siz = 2 * (io_buffer_size ? io_buffer_size : IO_BUFFER_SIZE);
+	if (iobuf_in_siz < BIGPATHBUFLEN)
+		iobuf_in_siz = BIGPATHBUFLEN;
 	if (!(iobuf_in = new_array(char, iobuf_in_siz)))
 		out_of_memory("io_start_buffering_in");
 	iobuf_f_in = f_in;
@@ -926,6 +943,7 @@ void io_end_buffering_in(void)
 	iobuf_in = NULL;
 	iobuf_in_ndx = 0;
 	iobuf_in_remaining = 0;
+	iobuf_in_data = 0;
 	iobuf_f_in = -1;
 }
 
@@ -934,7 +952,7 @@ void io_end_buffering_out(void)
 	if (!iobuf_out)
 		return;
 	io_flush(FULL_FLUSH);
-	free(iobuf_out);
+	free(iobuf_out - 4);
 	iobuf_out = NULL;
 	iobuf_f_out = -1;
 }
@@ -979,12 +997,38 @@ void stop_flist_forward(void)
 	io_flush(FULL_FLUSH);
 }
 
+/* Read from fd into iobuf_in until it holds at least need bytes, taking
+ * whatever else is ready too (as much as fits). */
+static void fill_iobuf_in(int fd, size_t need)
+{
+	size_t end;
+
+	if (!iobuf_in_remaining || iobuf_in_ndx + need > iobuf_in_siz) {
+		memmove(iobuf_in, iobuf_in + iobuf_in_ndx, iobuf_in_remaining);
+		iobuf_in_ndx = 0;
+	}
+
+	while (iobuf_in_remaining < need) {
+		end = iobuf_in_ndx + iobuf_in_remaining;
+		iobuf_in_remaining += read_timeout(fd, iobuf_in + end,
+						   iobuf_in_siz - end);
+	}
+}
+
 /**
  * Continue trying to read len bytes - don't return until len has been
- * read.
+ * read.  The buffered input fd is read through iobuf_in.
  **/
 static void read_loop(int fd, char *buf, size_t len)
 {
+	if (iobuf_in && fd == iobuf_f_in) {
+		fill_iobuf_in(fd, len);
+		memcpy(buf, iobuf_in + iobuf_in_ndx, len);
+		iobuf_in_ndx += len;
+		iobuf_in_remaining -= len;
+		return;
+	}
+
 	while (len) {
 		int n = read_timeout(fd, buf, len);
 
@@ -1008,18 +1052,23 @@ static int readfd_unbuffered(int fd, char *buf, size_t len)
 	if (!iobuf_in || fd != iobuf_f_in)
 		return read_timeout(fd, buf, len);
 
-	if (!io_multiplexing_in && iobuf_in_remaining == 0) {
-		iobuf_in_remaining = read_timeout(fd, iobuf_in, iobuf_in_siz);
-		iobuf_in_ndx = 0;
-	}
-
 	while (cnt == 0) {
-		if (iobuf_in_remaining) {
-			len = MIN(len, iobuf_in_remaining);
-			memcpy(buf, iobuf_in + iobuf_in_ndx, len);
-			iobuf_in_ndx += len;
-			iobuf_in_remaining -= len;
-			cnt = len;
+		if (!io_multiplexing_in || iobuf_in_data) {
+			if (io_multiplexing_in)
+				len = MIN(len, iobuf_in_data);
+			if (!iobuf_in_remaining && len >= IO_BUFFER_SIZE) {
+				/* A big read goes right into buf. */
+				cnt = read_timeout(fd, buf, len);
+			} else {
+				if (!iobuf_in_remaining)
+					fill_iobuf_in(fd, 1);
+				cnt = MIN(len, iobuf_in_remaining);
+				memcpy(buf, iobuf_in + iobuf_in_ndx, cnt);
+				iobuf_in_ndx += cnt;
+				iobuf_in_remaining -= cnt;
+			}
+			if (io_multiplexing_in)
+				iobuf_in_data -= cnt;
 			break;
 		}
 
@@ -1031,15 +1080,7 @@ static int readfd_unbuffered(int fd, char *buf, size_t len)
 
 		switch (tag) {
 		case MSG_DATA:
-			if (msg_bytes > iobuf_in_siz) {
-				if (!(iobuf_in = realloc_array(iobuf_in, char,
-							       msg_bytes)))
-					out_of_memory("readfd_unbuffered");
-				iobuf_in_siz = msg_bytes;
-			}
-			read_loop(fd, iobuf_in, msg_bytes);
-			iobuf_in_remaining = msg_bytes;
-			iobuf_in_ndx = 0;
+			iobuf_in_data = msg_bytes;
 			break;
 		case MSG_NOOP:
 			if (msg_bytes != 0)
@@ -1368,61 +1409,6 @@ void write_sum_head(int f, struct sum_struct *sum)
 	write_int(f, sum->remainder);
 }
 
-/**
- * Sleep after writing to limit I/O bandwidth usage.
- *
- * @todo Rather than sleeping after each write, it might be better to
- * use some kind of averaging.  The current algorithm seems to always
- * use a bit less bandwidth than specified, because it doesn't make up
- * for slow periods.  But arguably this is a feature.  In addition, we
- * ought to take the time used to write the data into account.
- *
- * During some phases of big transfers (file FOO is uptodate) this is
- * called with a small bytes_written every time.  As the kernel has to
- * round small waits up to guarantee that we actually wait at least the
- * requested number of microseconds, this can become grossly inaccurate.
- * We therefore keep track of the bytes we've written over time and only
- * sleep when the accumulated delay is at least 1 tenth of a second.
- **/
-static void sleep_for_bwlimit(int bytes_written)
-{
-	static struct timeval prior_tv;
-	static long total_written = 0;
-	struct timeval tv, start_tv;
-	long elapsed_usec, sleep_usec;
-
-#define ONE_SEC	1000000L /* # of microseconds in a second */
-
-	if (!bwlimit_writemax)
-		return;
-
-	total_written += bytes_written;
-
-	gettimeofday(&start_tv, NULL);
-	if (prior_tv.tv_sec) {
-		elapsed_usec = (start_tv.tv_sec - prior_tv.tv_sec) * ONE_SEC
-			     + (start_tv.tv_usec - prior_tv.tv_usec);
-		total_written -= elapsed_usec * bwlimit / (ONE_SEC/1024);
-		if (total_written < 0)
-			total_written = 0;
-	}
-
-	sleep_usec = total_written * (ONE_SEC/1024) / bwlimit;
-	if (sleep_usec < ONE_SEC / 10) {
-		prior_tv = start_tv;
-		return;
-	}
-
-	tv.tv_sec  = sleep_usec / ONE_SEC;
-	tv.tv_usec = sleep_usec % ONE_SEC;
-	select(0, NULL, NULL, NULL, &tv);
-
-	gettimeofday(&prior_tv, NULL);
-	elapsed_usec = (prior_tv.tv_sec - start_tv.tv_sec) * ONE_SEC
-		     + (prior_tv.tv_usec - start_tv.tv_usec);
-	total_written = (sleep_usec - elapsed_usec) * bwlimit / (ONE_SEC/1024);
-}
-
 static const char *what_fd_is(int fd)
 {
 	static char buf[20];
@@ -1439,45 +1425,61 @@ static const char *what_fd_is(int fd)
 	}
 }
 
-/* Write len bytes to the file descriptor fd, looping as necessary to get
- * the job done and also (in certain circumstances) reading any data on
- * msg_fd_in to avoid deadlock.
+/* Write up to n bytes from the iov_cnt buffers in iov with one system
+ * call. */
+static ssize_t write_iov(int fd, struct iovec *iov, int iov_cnt, size_t n)
+{
+#ifdef HAVE_WRITEV
+	struct iovec v[MAX_OUT_IOVS];
+	int j;
+
+	if (iov_cnt > 1 && n > iov[0].iov_len) {
+		for (j = 0; j < iov_cnt && n; j++) {
+			v[j] = iov[j];
+			if (v[j].iov_len > n)
+				v[j].iov_len = n;
+			n -= v[j].iov_len;
+		}
+		return writev(fd, v, j);
+	}
+#endif
+	return write(fd, iov[0].iov_base, MIN(n, iov[0].iov_len));
+}
+
+/* Write the data in the iov_cnt buffers of iov to the file descriptor fd,
+ * looping as necessary to get the job done and also (in certain
+ * circumstances) reading any data on msg_fd_in to avoid deadlock.  The
+ * iovecs get used up along the way.
  *
  * This function underlies the multiplexing system.  The body of the
  * application never calls this function directly. */
-static void writefd_unbuffered(int fd, const char *buf, size_t len)
+static void writev_unbuffered(int fd, struct iovec *iov, int iov_cnt)
 {
-	size_t n, total = 0;
-	fd_set w_fds, r_fds, e_fds;
-	int maxfd, count, cnt, using_r_fds;
+	size_t n, len, total = 0;
+	int count, cnt, j;
 	int defer_inc = 0;
-	struct timeval tv;
+	/* Unless there are messages to watch for, our (nonblocking) socket
+	 * and the batch file get written before we wait on them. */
+	int try_write = (fd == sock_f_out || fd == msg_fd_out || fd == batch_fd)
+		     && msg_fd_in < 0;
+
+	for (len = 0, j = 0; j < iov_cnt; j++)
+		len += iov[j].iov_len;
 
 	if (no_flush++)
 		defer_forwarding_messages++, defer_inc++;
 
 	while (total < len) {
-		FD_ZERO(&w_fds);
-		FD_SET(fd, &w_fds);
-		FD_ZERO(&e_fds);
-		FD_SET(fd, &e_fds);
-		maxfd = fd;
-
-		if (msg_fd_in >= 0) {
-			FD_ZERO(&r_fds);
-			FD_SET(msg_fd_in, &r_fds);
-			if (msg_fd_in > maxfd)
-				maxfd = msg_fd_in;
-			using_r_fds = 1;
-		} else
-			using_r_fds = 0;
+		if (try_write)
+			goto try_it;
 
-		tv.tv_sec = select_timeout;
-		tv.tv_usec = 0;
+		evloop_add(fd, EVL_WRITE);
+		evloop_add(msg_fd_in, EVL_READ);
 
 		errno = 0;
-		count = select(maxfd + 1, using_r_fds ? &r_fds : NULL,
-			       &w_fds, &e_fds, &tv);
+		count = evloop_wait(select_timeout);
+		if (fd == sock_f_out)
+			stats.sock_wait_calls++;
 
 		if (count <= 0) {
 			if (count < 0 && errno == EBADF)
@@ -1486,28 +1488,36 @@ static void writefd_unbuffered(int fd, const char *buf, size_t len)
 			continue;
 		}
 
-		/*if (FD_ISSET(fd, &e_fds))
-			rprintf(FINFO, "select exception on fd %d\n", fd); */
-
-		if (using_r_fds && FD_ISSET(msg_fd_in, &r_fds))
+		if (msg_fd_in >= 0 && evloop_ready(msg_fd_in) & EVL_READ)
 			read_msg_fd();
 
-		if (!FD_ISSET(fd, &w_fds))
+		if (!(evloop_ready(fd) & EVL_WRITE))
 			continue;
 
+	  try_it:
 		n = len - total;
-		if (bwlimit_writemax && n > bwlimit_writemax)
-			n = bwlimit_writemax;
-		cnt = write(fd, buf + total, n);
+		if (fd == sock_f_out)
+			n = bwlimit_max_io(n);
+		cnt = write_iov(fd, iov, iov_cnt, n);
+		if (fd == sock_f_out)
+			stats.sock_write_calls++;
 
 		if (cnt <= 0) {
 			if (cnt < 0) {
 				if (errno == EINTR)
 					continue;
 				if (errno == EWOULDBLOCK || errno == EAGAIN) {
-					msleep(1);
+					try_write = 0;
 					continue;
 				}
+				if (errno == EFAULT) {
+					for (j = 0; j < iov_cnt; j++) {
+						if (mmap_fault_in(iov[j].iov_base, iov[j].iov_len))
+							break;
+					}
+					if (j < iov_cnt)
+						continue;
+				}
 			}
 
 			/* Don't try to write errors back across the stream. */
@@ -1536,7 +1546,14 @@ static void writefd_unbuffered(int fd, const char *buf, size_t len)
 		if (fd == sock_f_out) {
 			if (io_timeout || am_generator)
 				last_io_out = time(NULL);
-			sleep_for_bwlimit(cnt);
+			bwlimit_account(BWL_OUT, cnt);
+		}
+
+		for (n = cnt; iov_cnt && n >= iov->iov_len; iov++, iov_cnt--)
+			n -= iov->iov_len;
+		if (n) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
 		}
 	}
 
@@ -1547,6 +1564,16 @@ static void writefd_unbuffered(int fd, const char *buf, size_t len)
 		msg_flush();
 }
 
+/* Write len bytes from buf to fd (see writev_unbuffered()). */
+static void writefd_unbuffered(int fd, const char *buf, size_t len)
+{
+	struct iovec iov;
+
+	iov.iov_base = (char *)buf;
+	iov.iov_len = len;
+	writev_unbuffered(fd, &iov, 1);
+}
+
 int io_flush(int flush_it_all)
 {
 	int flushed_something = 0;
@@ -1555,11 +1582,7 @@ int io_flush(int flush_it_all)
 		return 0;
 
 	if (iobuf_out_cnt) {
-		if (io_multiplexing_out)
-			mplex_write(sock_f_out, MSG_DATA, iobuf_out, iobuf_out_cnt, 0);
-		else
-			writefd_unbuffered(iobuf_f_out, iobuf_out, iobuf_out_cnt);
-		iobuf_out_cnt = 0;
+		flush_iobuf_out(NULL, 0);
 		flushed_something = 1;
 	}
 
@@ -1571,6 +1594,33 @@ int io_flush(int flush_it_all)
 	return flushed_something;
 }
 
+/* Write out iobuf_out followed by len bytes from buf (if any), which
+ * saves copying buf into the buffer when it would just fill it up.  When
+ * we're multiplexing, the data goes out as one MSG_DATA message whose
+ * header is put in the room before iobuf_out. */
+static void flush_iobuf_out(const char *buf, size_t len)
+{
+	struct iovec iov[MAX_OUT_IOVS];
+	size_t total = iobuf_out_cnt + len;
+	int cnt = 0;
+
+	if (io_multiplexing_out) {
+		SIVAL(iobuf_out - 4, 0, ((MPLEX_BASE + (int)MSG_DATA)<<24) + total);
+		iov[cnt].iov_base = iobuf_out - 4;
+		iov[cnt++].iov_len = iobuf_out_cnt + 4;
+	} else {
+		iov[cnt].iov_base = iobuf_out;
+		iov[cnt++].iov_len = iobuf_out_cnt;
+	}
+	if (len) {
+		iov[cnt].iov_base = (char *)buf;
+		iov[cnt++].iov_len = len;
+	}
+
+	writev_unbuffered(iobuf_f_out, iov, cnt);
+	iobuf_out_cnt = 0;
+}
+
 static void writefd(int fd, const char *buf, size_t len)
 {
 	if (fd == sock_f_out)
@@ -1584,8 +1634,16 @@ static void writefd(int fd, const char *buf, size_t len)
 		return;
 	}
 
+#ifdef HAVE_WRITEV
+	if (len >= IO_BUFFER_SIZE && iobuf_out_cnt + len > (size_t)iobuf_out_siz
+	 && iobuf_out_cnt + len <= MAX_MPLEX_DATA && !no_flush) {
+		flush_iobuf_out(buf, len);
+		return;
+	}
+#endif
+
 	while (len) {
-		int n = MIN((int)len, IO_BUFFER_SIZE - iobuf_out_cnt);
+		int n = MIN((int)len, iobuf_out_siz - iobuf_out_cnt);
 		if (n > 0) {
 			memcpy(iobuf_out+iobuf_out_cnt, buf, n);
 			buf += n;
@@ -1593,7 +1651,7 @@ static void writefd(int fd, const char *buf, size_t len)
 			iobuf_out_cnt += n;
 		}
 
-		if (iobuf_out_cnt == IO_BUFFER_SIZE)
+		if (iobuf_out_cnt == iobuf_out_siz)
 			io_flush(NORMAL_FLUSH);
 	}
 }
@@ -0,0 +1,96 @@
+/*
+ * The CRC32C (Castagnoli) checksum, used as an alternative to the
+ * Adler-style rolling checksum.  The CRC is kept in its raw form (a zero
+ * starting value with no final inversion), which makes it linear: leading
+ * zero bytes don't change it, so dropping the first byte of a window of
+ * a fixed length is just an XOR with a value from crc32c_roll_table[].
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+#include "rsync.h"
+
+#define CRC32C_POLY 0x82F63B78 /* the bit-reversed Castagnoli polynomial */
+
+uint32 crc32c_table[256];
+uint32 crc32c_roll_table[256];
+
+static int32 roll_len = -1;
+
+/* Fill in crc32c_table[].  This must be called before any of the other
+ * routines, and before any threads are started. */
+void crc32c_init(void)
+{
+	uint32 crc;
+	int j, b;
+
+	if (crc32c_table[1])
+		return;
+
+	for (j = 0; j < 256; j++) {
+		crc = j;
+		for (b = 0; b < 8; b++)
+			crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+		crc32c_table[j] = crc;
+	}
+}
+
+/* Continue the raw CRC32C crc over len more bytes of buf.  The SSE4.2
+ * crc32 instruction is used when the CPU has it. */
+uint32 crc32c_update(uint32 crc, const uchar *buf, int32 len)
+{
+	int32 i;
+
+#ifdef USE_SIMD_CHECKSUM
+	i = get_crc32c_simd(&crc, buf, len);
+#else
+	i = 0;
+#endif
+	for ( ; i < len; i++)
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ buf[i]) & 0xFF];
+
+	return crc;
+}
+
+/* Set up crc32c_roll_table[] for a window of len bytes, so that
+ * CRC32C_ROLL() can move such a window forward one byte at a time.  An
+ * entry is the CRC of its byte followed by len zeros, which is what
+ * the byte contributes to the CRC of the len+1 bytes that it starts. */
+void crc32c_roll_init(int32 len)
+{
+	static const uchar zeros[1024];
+	uint32 bits[8];
+	int32 n;
+	int j, b;
+
+	if (len == roll_len)
+		return;
+
+	for (b = 0; b < 8; b++) {
+		bits[b] = crc32c_table[1 << b];
+		for (n = len; n > 0; n -= sizeof zeros)
+			bits[b] = crc32c_update(bits[b], zeros, MIN(n, (int32)sizeof zeros));
+	}
+
+	for (j = 0; j < 256; j++) {
+		uint32 crc = 0;
+		for (b = 0; b < 8; b++) {
+			if (j & (1 << b))
+				crc ^= bits[b];
+		}
+		crc32c_roll_table[j] = crc;
+	}
+
+	roll_len = len;
+}
@@ -26,8 +26,6 @@
  *
  * It assumes that a int is at least 32 bits long. */
 
-static md_context *m;
-
 #define MASK32 (0xffffffff)
 
 #define F(X,Y,Z) ((((X)&(Y)) | ((~(X))&(Z))))
@@ -40,7 +38,7 @@ static md_context *m;
 #define ROUND3(a,b,c,d,k,s) a = lshift((a + H(b,c,d) + M[k] + 0x6ED9EBA1)&MASK32,s)
 
 /* this applies md4 to 64 byte chunks */
-static void mdfour64(uint32 *M)
+static void mdfour64(md_context *m, uint32 *M)
 {
 	uint32 AA, BB, CC, DD;
 	uint32 A,B,C,D;
@@ -112,7 +110,7 @@ void mdfour_begin(md_context *md)
 	md->totalN2 = 0;
 }
 
-static void mdfour_tail(const uchar *in, uint32 length)
+static void mdfour_tail(md_context *m, const uchar *in, uint32 length)
 {
 	uchar buf[128];
 	uint32 M[16];
@@ -142,7 +140,7 @@ static void mdfour_tail(const uchar *in, uint32 length)
 		if (protocol_version >= 27)
 			copy4(buf+60, m->totalN2);
 		copy64(M, buf);
-		mdfour64(M);
+		mdfour64(m, M);
 	} else {
 		copy4(buf+120, m->totalN); 
 		/*
@@ -154,24 +152,22 @@ static void mdfour_tail(const uchar *in, uint32 length)
 		if (protocol_version >= 27)
 			copy4(buf+124, m->totalN2); 
 		copy64(M, buf);
-		mdfour64(M);
+		mdfour64(m, M);
 		copy64(M, buf+64);
-		mdfour64(M);
+		mdfour64(m, M);
 	}
 }
 
-void mdfour_update(md_context *md, const uchar *in, uint32 length)
+void mdfour_update(md_context *m, const uchar *in, uint32 length)
 {
 	uint32 M[16];
 
-	m = md;
-
 	if (length == 0)
-		mdfour_tail(in, length);
+		mdfour_tail(m, in, length);
 
 	while (length >= 64) {
 		copy64(M, in);
-		mdfour64(M);
+		mdfour64(m, M);
 		in += 64;
 		length -= 64;
 		m->totalN += 64 << 3;
@@ -180,13 +176,11 @@ void mdfour_update(md_context *md, const uchar *in, uint32 length)
 	}
 
 	if (length)
-		mdfour_tail(in, length);
+		mdfour_tail(m, in, length);
 }
 
-void mdfour_result(md_context *md, uchar digest[MD4_DIGEST_LEN])
+void mdfour_result(md_context *m, uchar digest[MD4_DIGEST_LEN])
 {
-	m = md;
-
 	copy4(digest, m->A);
 	copy4(digest+4, m->B);
 	copy4(digest+8, m->C);
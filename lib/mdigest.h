@@ -1,7 +1,8 @@
-/* The include file for both the MD4 and MD5 routines. */
+/* The include file for the MD4, MD5, XXH64, and CRC32C routines. */
 
 #define MD4_DIGEST_LEN 16
 #define MD5_DIGEST_LEN 16
+#define XXH64_DIGEST_LEN 8
 #define MAX_DIGEST_LEN MD5_DIGEST_LEN
 
 #define CSUM_CHUNK 64
@@ -24,3 +25,34 @@ void md5_update(md_context *ctx, const uchar *input, uint32 length);
 void md5_result(md_context *ctx, uchar digest[MD5_DIGEST_LEN]);
 
 void get_md5(uchar digest[MD5_DIGEST_LEN], const uchar *input, int n);
+
+#ifdef SUPPORT_XXH64
+#define XXH64_STRIPE_LEN 32
+
+typedef struct {
+	uint64 v1, v2, v3, v4;
+	uint64 seed;
+	uint64 total_len;
+	uchar mem[XXH64_STRIPE_LEN];
+	uint32 memsize;
+} xxh64_context;
+
+void xxh64_begin(xxh64_context *ctx, uint64 seed);
+void xxh64_update(xxh64_context *ctx, const uchar *input, uint32 length);
+void xxh64_result(xxh64_context *ctx, uchar digest[XXH64_DIGEST_LEN]);
+
+void get_xxh64(uchar digest[XXH64_DIGEST_LEN], const uchar *input, int n, uint64 seed);
+#endif
+
+extern uint32 crc32c_table[256];
+extern uint32 crc32c_roll_table[256];
+
+/* Move a window of the length given to crc32c_roll_init() forward one byte,
+ * dropping the byte "out" off the front and adding "in" to the end. */
+#define CRC32C_ROLL(crc, out, in) \
+	(((crc) >> 8) ^ crc32c_table[((crc) ^ (uchar)(in)) & 0xFF] \
+	 ^ crc32c_roll_table[(uchar)(out)])
+
+void crc32c_init(void);
+uint32 crc32c_update(uint32 crc, const uchar *buf, int32 len);
+void crc32c_roll_init(int32 len);
@@ -0,0 +1,157 @@
+/*
+ * An implementation of the XXH64 hash function, written from the xxHash
+ * specification (https://github.com/Cyan4973/xxHash).  XXH64 is not a
+ * cryptographic hash, but it is many times faster than MD5 and its 64-bit
+ * result is well distributed.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+#include "rsync.h"
+
+#ifdef SUPPORT_XXH64
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64 get64(const uchar *p)
+{
+	return (uint64)IVALu(p, 0) | ((uint64)IVALu(p, 4) << 32);
+}
+
+static inline uint64 xxh64_round(uint64 acc, uint64 input)
+{
+	acc += input * PRIME64_2;
+	acc = ROTL64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64 xxh64_merge(uint64 acc, uint64 val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+void xxh64_begin(xxh64_context *ctx, uint64 seed)
+{
+	ctx->v1 = seed + PRIME64_1 + PRIME64_2;
+	ctx->v2 = seed + PRIME64_2;
+	ctx->v3 = seed;
+	ctx->v4 = seed - PRIME64_1;
+	ctx->seed = seed;
+	ctx->total_len = 0;
+	ctx->memsize = 0;
+}
+
+static const uchar *xxh64_stripes(xxh64_context *ctx, const uchar *p, const uchar *limit)
+{
+	uint64 v1 = ctx->v1, v2 = ctx->v2, v3 = ctx->v3, v4 = ctx->v4;
+
+	do {
+		v1 = xxh64_round(v1, get64(p));
+		v2 = xxh64_round(v2, get64(p + 8));
+		v3 = xxh64_round(v3, get64(p + 16));
+		v4 = xxh64_round(v4, get64(p + 24));
+		p += XXH64_STRIPE_LEN;
+	} while (p <= limit);
+
+	ctx->v1 = v1; ctx->v2 = v2; ctx->v3 = v3; ctx->v4 = v4;
+
+	return p;
+}
+
+void xxh64_update(xxh64_context *ctx, const uchar *input, uint32 length)
+{
+	const uchar *p = input, *end = input + length;
+
+	ctx->total_len += length;
+
+	if (ctx->memsize + length < XXH64_STRIPE_LEN) {
+		memcpy(ctx->mem + ctx->memsize, input, length);
+		ctx->memsize += length;
+		return;
+	}
+
+	if (ctx->memsize) {
+		uint32 fill = XXH64_STRIPE_LEN - ctx->memsize;
+		memcpy(ctx->mem + ctx->memsize, p, fill);
+		xxh64_stripes(ctx, ctx->mem, ctx->mem);
+		p += fill;
+		ctx->memsize = 0;
+	}
+
+	if (end - p >= XXH64_STRIPE_LEN)
+		p = xxh64_stripes(ctx, p, end - XXH64_STRIPE_LEN);
+
+	if (p < end) {
+		memcpy(ctx->mem, p, end - p);
+		ctx->memsize = end - p;
+	}
+}
+
+void xxh64_result(xxh64_context *ctx, uchar digest[XXH64_DIGEST_LEN])
+{
+	const uchar *p = ctx->mem, *end = ctx->mem + ctx->memsize;
+	uint64 h;
+
+	if (ctx->total_len >= XXH64_STRIPE_LEN) {
+		h = ROTL64(ctx->v1, 1) + ROTL64(ctx->v2, 7)
+		  + ROTL64(ctx->v3, 12) + ROTL64(ctx->v4, 18);
+		h = xxh64_merge(h, ctx->v1);
+		h = xxh64_merge(h, ctx->v2);
+		h = xxh64_merge(h, ctx->v3);
+		h = xxh64_merge(h, ctx->v4);
+	} else
+		h = ctx->seed + PRIME64_5;
+
+	h += ctx->total_len;
+
+	for ( ; p + 8 <= end; p += 8) {
+		h ^= xxh64_round(0, get64(p));
+		h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64)IVALu(p, 0) * PRIME64_1;
+		h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for ( ; p < end; p++) {
+		h ^= *p * PRIME64_5;
+		h = ROTL64(h, 11) * PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	SIVALu(digest, 0, (uint32)h);
+	SIVALu(digest, 4, (uint32)(h >> 32));
+}
+
+void get_xxh64(uchar digest[XXH64_DIGEST_LEN], const uchar *input, int n, uint64 seed)
+{
+	xxh64_context ctx;
+
+	xxh64_begin(&ctx, seed);
+	xxh64_update(&ctx, input, n);
+	xxh64_result(&ctx, digest);
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+ * The scans for runs of zeros that --sparse turns into holes.  The bulk of
+ * a run of zeros is checked by an SSE2 or AVX2 kernel when the CPU has one
+ * (see simd-checksum-x86_64.c), and otherwise a word at a time.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+#include "rsync.h"
+
+#define WORD_OFFSET(p) ((unsigned long)(p) % sizeof (unsigned long))
+
+/* Return how many zero bytes buf starts with. */
+int32 count_zeros(const char *buf, int32 len)
+{
+	const int32 step = 4 * sizeof (unsigned long);
+	int32 i;
+
+#ifdef USE_SIMD_CHECKSUM
+	i = count_zeros_simd(buf, len);
+#else
+	i = 0;
+#endif
+
+	for ( ; i < len && WORD_OFFSET(buf + i); i++) {
+		if (buf[i])
+			return i;
+	}
+	for ( ; i + step <= len; i += step) {
+		const unsigned long *w = (const unsigned long *)(buf + i);
+		if (w[0] | w[1] | w[2] | w[3])
+			break;
+	}
+	for ( ; i < len && !buf[i]; i++) {}
+
+	return i;
+}
+
+/* Return the offset of the first run of at least min_run zeros in buf, or
+ * of the zeros that end it (however few), or len if neither is there.  Any
+ * run of min_run zeros covers a whole block of min_run/2 bytes that starts
+ * at a multiple of min_run/2, so only those blocks need checking, and a
+ * block of data is usually rejected by its first few bytes. */
+int32 find_zero_run(const char *buf, int32 len, int32 min_run)
+{
+	int32 step = MAX(min_run / 2, 1);
+	int32 b, start, end;
+
+	for (b = 0; b + step <= len; ) {
+		if (buf[b] || count_zeros(buf + b, step) < step) {
+			b += step;
+			continue;
+		}
+		for (start = b; start > 0 && !buf[start-1]; start--) {}
+		end = b + step;
+		end += count_zeros(buf + end, len - end);
+		if (end == len || end - start >= min_run)
+			return start;
+		b = end - end % step + step;
+	}
+
+	for (end = len; end > 0 && !buf[end-1]; end--) {}
+
+	return end;
+}
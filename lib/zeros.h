@@ -0,0 +1,2 @@
+int32 count_zeros(const char *buf, int32 len);
+int32 find_zero_run(const char *buf, int32 len, int32 min_run);
@@ -104,10 +104,14 @@ struct parm_struct
 typedef struct
 {
 	char *bind_address;
+	char *bwlimit_status_file;
 	char *motd_file;
 	char *pid_file;
 	char *socket_options;
 
+	int daemon_bwlimit;
+	int prefork_sessions;
+	int prefork_workers;
 	int rsync_port;
 } global;
 
@@ -147,8 +151,11 @@ typedef struct
 	char *temp_dir;
 	char *uid;
 
+	int bwlimit;
+	int bwlimit_burst;
 	int max_connections;
 	int max_verbosity;
+	int module_bwlimit;
 	int syslog_facility;
 	int timeout;
 
@@ -198,8 +205,11 @@ static service sDefault =
  /* temp_dir; */ 		NULL,
  /* uid; */			NOBODY_USER,
 
+ /* bwlimit; */			0,
+ /* bwlimit_burst; */		0,
  /* max_connections; */		0,
  /* max_verbosity; */		1,
+ /* module_bwlimit; */		0,
  /* syslog_facility; */		LOG_DAEMON,
  /* timeout; */			0,
 
@@ -297,12 +307,18 @@ static struct enum_list enum_facilities[] = {
 static struct parm_struct parm_table[] =
 {
  {"address",           P_STRING, P_GLOBAL,&Globals.bind_address,       NULL,0},
+ {"bwlimit status file",P_STRING,P_GLOBAL,&Globals.bwlimit_status_file,NULL,0},
+ {"daemon bwlimit",    P_INTEGER,P_GLOBAL,&Globals.daemon_bwlimit,     NULL,0},
  {"motd file",         P_STRING, P_GLOBAL,&Globals.motd_file,          NULL,0},
  {"pid file",          P_STRING, P_GLOBAL,&Globals.pid_file,           NULL,0},
  {"port",              P_INTEGER,P_GLOBAL,&Globals.rsync_port,         NULL,0},
+ {"prefork sessions",  P_INTEGER,P_GLOBAL,&Globals.prefork_sessions,   NULL,0},
+ {"prefork workers",   P_INTEGER,P_GLOBAL,&Globals.prefork_workers,    NULL,0},
  {"socket options",    P_STRING, P_GLOBAL,&Globals.socket_options,     NULL,0},
 
  {"auth users",        P_STRING, P_LOCAL, &sDefault.auth_users,        NULL,0},
+ {"bwlimit burst",     P_INTEGER,P_LOCAL, &sDefault.bwlimit_burst,     NULL,0},
+ {"bwlimit",           P_INTEGER,P_LOCAL, &sDefault.bwlimit,           NULL,0},
  {"charset",           P_STRING, P_LOCAL, &sDefault.charset,           NULL,0},
  {"comment",           P_STRING, P_LOCAL, &sDefault.comment,           NULL,0},
  {"dont compress",     P_STRING, P_LOCAL, &sDefault.dont_compress,     NULL,0},
@@ -324,6 +340,7 @@ static struct parm_struct parm_table[] =
  {"log format",        P_STRING, P_LOCAL, &sDefault.log_format,        NULL,0},
  {"max connections",   P_INTEGER,P_LOCAL, &sDefault.max_connections,   NULL,0},
  {"max verbosity",     P_INTEGER,P_LOCAL, &sDefault.max_verbosity,     NULL,0},
+ {"module bwlimit",    P_INTEGER,P_LOCAL, &sDefault.module_bwlimit,    NULL,0},
  {"munge symlinks",    P_BOOL,   P_LOCAL, &sDefault.munge_symlinks,    NULL,0},
  {"name",              P_STRING, P_LOCAL, &sDefault.name,              NULL,0},
  {"numeric ids",       P_BOOL,   P_LOCAL, &sDefault.numeric_ids,       NULL,0},
@@ -354,6 +371,7 @@ static struct parm_struct parm_table[] =
 static void init_globals(void)
 {
 	memset(&Globals, 0, sizeof Globals);
+	Globals.prefork_sessions = 100;
 }
 
 /***************************************************************************
@@ -389,10 +407,14 @@ static void init_locals(void)
 
 
 FN_GLOBAL_STRING(lp_bind_address, &Globals.bind_address)
+FN_GLOBAL_STRING(lp_bwlimit_status_file, &Globals.bwlimit_status_file)
 FN_GLOBAL_STRING(lp_motd_file, &Globals.motd_file)
 FN_GLOBAL_STRING(lp_pid_file, &Globals.pid_file)
 FN_GLOBAL_STRING(lp_socket_options, &Globals.socket_options)
 
+FN_GLOBAL_INTEGER(lp_daemon_bwlimit, &Globals.daemon_bwlimit)
+FN_GLOBAL_INTEGER(lp_prefork_sessions, &Globals.prefork_sessions)
+FN_GLOBAL_INTEGER(lp_prefork_workers, &Globals.prefork_workers)
 FN_GLOBAL_INTEGER(lp_rsync_port, &Globals.rsync_port)
 
 FN_LOCAL_STRING(lp_auth_users, auth_users)
@@ -421,8 +443,11 @@ FN_LOCAL_STRING(lp_secrets_file, secrets_file)
 FN_LOCAL_STRING(lp_temp_dir, temp_dir)
 FN_LOCAL_STRING(lp_uid, uid)
 
+FN_LOCAL_INTEGER(lp_bwlimit, bwlimit)
+FN_LOCAL_INTEGER(lp_bwlimit_burst, bwlimit_burst)
 FN_LOCAL_INTEGER(lp_max_connections, max_connections)
 FN_LOCAL_INTEGER(lp_max_verbosity, max_verbosity)
+FN_LOCAL_INTEGER(lp_module_bwlimit, module_bwlimit)
 FN_LOCAL_INTEGER(lp_syslog_facility, syslog_facility)
 FN_LOCAL_INTEGER(lp_timeout, timeout)
 
@@ -833,6 +858,9 @@ BOOL lp_load(char *pszFname, int globals_only)
 
 	init_globals();
 
+	/* A reload starts the module list over (dropping the old entries). */
+	iNumServices = 0;
+
 	pstrcpy(n2, pszFname);
 
 	/* We get sections first, so have to start 'behind' to make up */
@@ -64,6 +64,9 @@ extern int write_batch;
 extern int batch_fd;
 extern int filesfrom_fd;
 extern int connect_timeout;
+extern int adaptive_block_size;
+extern int use_mmap;
+extern int use_prefetch;
 extern pid_t cleanup_child_pid;
 extern unsigned int module_dirlen;
 extern struct stats stats;
@@ -188,6 +191,25 @@ static void handle_stats(int f)
 		/* These come out from every process */
 		show_malloc_stats();
 		show_flist_stats();
+		rprintf(FINFO, "[%s] file read wait time: %.3f seconds\n",
+			who_am_i(), (double)stats.read_wait_time / 1000000);
+		if (stats.file_write_calls) {
+			rprintf(FINFO,
+				"[%s] file writes: %s bytes in %s calls (%s bytes/call)\n",
+				who_am_i(), human_num(stats.file_write_bytes),
+				human_num(stats.file_write_calls),
+				human_num(stats.file_write_bytes / stats.file_write_calls));
+		}
+		if (total_read + total_written) {
+			int64 calls = stats.sock_read_calls + stats.sock_write_calls
+				    + stats.sock_wait_calls;
+			rprintf(FINFO,
+				"[%s] socket I/O: %s reads, %s writes, %s waits (%.1f calls/MB)\n",
+				who_am_i(), human_num(stats.sock_read_calls),
+				human_num(stats.sock_write_calls),
+				human_num(stats.sock_wait_calls),
+				(double)calls * 1024 * 1024 / (total_read + total_written));
+		}
 	}
 
 	if (am_generator)
@@ -253,6 +275,14 @@ static void output_summary(void)
 			human_num(stats.literal_data));
 		rprintf(FINFO,"Matched data: %s bytes\n",
 			human_num(stats.matched_data));
+		if (adaptive_block_size) {
+			rprintf(FINFO,"Files with adapted block sizes: %d\n",
+				stats.adapted_block_files);
+		}
+		if (use_mmap || use_prefetch || verbose > 1) {
+			rprintf(FINFO,"File read wait time: %.3f seconds\n",
+				(double)stats.read_wait_time / 1000000);
+		}
 		rprintf(FINFO,"File list size: %s\n",
 			human_num(stats.flist_size));
 		if (stats.flist_buildtime) {
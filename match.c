@@ -25,34 +25,105 @@ extern int verbose;
 extern int do_progress;
 extern int checksum_seed;
 extern int append_mode;
+extern int checksum_threads;
+extern int cdc_mode;
+extern int adaptive_block_size;
 
 int updating_basis_file;
 
 static int false_alarms;
 static int hash_hits;
+static int filter_hits;
+static int filter_misses;
 static int matches;
 static int64 data_transfer;
 
 static int total_false_alarms;
 static int total_hash_hits;
+static int total_filter_hits;
+static int total_filter_misses;
 static int total_matches;
+static int64 total_blocks;
+static int64 total_block_bytes;
 
 extern struct stats stats;
 
 #define TRADITIONAL_TABLESIZE (1<<16)
 
+/* The hash table is bucketized: the entries for bucket t are the ones from
+ * hash_entries[hash_table[t]] up to hash_entries[hash_table[t+1]], and each
+ * entry has the chunk's sum1 right next to its index, so a hash hit only
+ * touches one or two cache lines until the sum1 values match.  A bucket's
+ * entries are in descending chunk order, which is the order the matches
+ * have always been tried in. */
+struct hash_entry {
+	uint32 sum1;
+	int32 i;
+};
+
 static uint32 tablesize;
 static int32 *hash_table;
+static struct hash_entry *hash_entries;
 
 #define SUM2HASH2(s1,s2) (((s1) + (s2)) & 0xFFFF)
 #define SUM2HASH(sum) SUM2HASH2((sum)&0xFFFF,(sum)>>16)
 
 #define BIG_SUM2HASH(sum) ((sum)%tablesize)
 
+/* A blocked Bloom filter over the sum1 values lets the search skip the
+ * hash-table lookup at most of the offsets that can't match.  Each sum1
+ * sets 2 bits in a single 32-bit word, and the filter is sized to stay in
+ * the L2 cache (which the hash table of a big file would not). */
+#define FILTER_MIN_BITS (1<<15)
+#define FILTER_MAX_BITS (1<<21)
+
+static uint32 *filter;
+static int filter_shift;
+
+static inline uint32 filter_hash(uint32 sum)
+{
+	sum ^= sum >> 16;
+	sum *= 0x85ebca6b;
+	sum ^= sum >> 13;
+	sum *= 0xc2b2ae35;
+	return sum ^ (sum >> 16);
+}
+
+#define FILTER_BITS(h) (((uint32)1 << ((h) & 31)) | ((uint32)1 << (((h) >> 5) & 31)))
+#define FILTER_HAS(h) ((filter[(h) >> filter_shift] & FILTER_BITS(h)) == FILTER_BITS(h))
+
+static void build_filter(struct sum_struct *s)
+{
+	static int32 alloc_words;
+	int32 bits, words, i;
+	int shift;
+
+	for (bits = FILTER_MIN_BITS; bits < FILTER_MAX_BITS && bits / 16 < s->count; bits <<= 1) {}
+	words = bits / 32;
+	for (shift = 32; (1 << (32 - shift)) < words; shift--) {}
+
+	if (words > alloc_words) {
+		if (filter)
+			free(filter);
+		if (!(filter = new_array(uint32, words)))
+			out_of_memory("build_filter");
+		alloc_words = words;
+	}
+	filter_shift = shift;
+
+	memset(filter, 0, words * sizeof filter[0]);
+	for (i = 0; i < s->count; i++) {
+		uint32 h = filter_hash(s->sum1_array[i]);
+		filter[h >> filter_shift] |= FILTER_BITS(h);
+	}
+}
+
 static void build_hash_table(struct sum_struct *s)
 {
 	static uint32 alloc_size;
-	int32 i;
+	static int32 alloc_count;
+	int32 i, j;
+	uint32 t;
 
 	/* Dynamically calculate the hash table size so that the hash load
 	 * for big files is about 80%.  A number greater than the traditional
@@ -63,32 +134,113 @@ static void build_hash_table(struct sum_struct *s)
 	if (tablesize > alloc_size || tablesize < alloc_size - 16*1024) {
 		if (hash_table)
 			free(hash_table);
-		hash_table = new_array(int32, tablesize);
+		hash_table = new_array(int32, tablesize + 1);
 		if (!hash_table)
 			out_of_memory("build_hash_table");
 		alloc_size = tablesize;
 	}
+	if (s->count > alloc_count) {
+		if (hash_entries)
+			free(hash_entries);
+		hash_entries = new_array(struct hash_entry, s->count);
+		if (!hash_entries)
+			out_of_memory("build_hash_table");
+		alloc_count = s->count;
+	}
 
-	memset(hash_table, 0xFF, tablesize * sizeof hash_table[0]);
+	memset(hash_table, 0, (tablesize + 1) * sizeof hash_table[0]);
 
-	if (tablesize == TRADITIONAL_TABLESIZE) {
-		for (i = 0; i < s->count; i++) {
-			uint32 t = SUM2HASH(s->sums[i].sum1);
-			s->sums[i].chain = hash_table[t];
-			hash_table[t] = i;
-		}
-	} else {
-		for (i = 0; i < s->count; i++) {
-			uint32 t = BIG_SUM2HASH(s->sums[i].sum1);
-			s->sums[i].chain = hash_table[t];
-			hash_table[t] = i;
-		}
+	/* Count the entries in each bucket, turn the counts into the end of
+	 * each bucket's run, and then fill each run from the end. */
+	for (i = 0; i < s->count; i++) {
+		uint32 sum = s->sum1_array[i];
+		t = tablesize == TRADITIONAL_TABLESIZE ? SUM2HASH(sum) : BIG_SUM2HASH(sum);
+		hash_table[t]++;
+	}
+	for (t = 1; t < tablesize; t++)
+		hash_table[t] += hash_table[t-1];
+	hash_table[tablesize] = s->count;
+
+	for (i = 0; i < s->count; i++) {
+		uint32 sum = s->sum1_array[i];
+		t = tablesize == TRADITIONAL_TABLESIZE ? SUM2HASH(sum) : BIG_SUM2HASH(sum);
+		j = --hash_table[t];
+		hash_entries[j].sum1 = sum;
+		hash_entries[j].i = i;
 	}
+
+	build_filter(s);
+}
+
+static int rolling_crc;
+
+/* Roll the weak sum of the k bytes at map forward one byte: map[0] drops
+ * off the front, and map[k] is added to the end if "more" is set (if not,
+ * the window is shrinking at the end of the file). */
+static inline uint32 roll_sum(struct sum_struct *s, uint32 sum, schar *map,
+			      int32 k, int more)
+{
+	uint32 s1, s2;
+
+	if (rolling_crc) {
+		if (more)
+			return CRC32C_ROLL(sum, map[0], map[k]);
+		/* A CRC can't cheaply drop a byte from a shrinking window,
+		 * but the only block that can match here is the last one,
+		 * so the sum only has to be right once we reach its size. */
+		if (k - 1 == s->sums[s->count-1].len)
+			return get_checksum1((char *)map + 1, k - 1);
+		return sum;
+	}
+
+	s1 = sum & 0xFFFF;
+	s2 = sum >> 16;
+	s1 -= map[0] + CHAR_OFFSET;
+	s2 -= k * (map[0]+CHAR_OFFSET);
+	if (more) {
+		s1 += map[k] + CHAR_OFFSET;
+		s2 += s1;
+	}
+	return (s1 & 0xFFFF) | (s2 << 16);
 }
 
 
 static OFF_T last_match;
 
+/* When --checksum-threads is used, the sender has worker threads scan ahead
+ * of the (serial) hash search.  Each one gets a range of offsets that it
+ * searches just like hash_search() does, recording every offset where a
+ * block has the same weak sum and length (along with that offset's strong
+ * sum).  The offsets that a worker stepped over without finding any such
+ * block are known to be uninteresting, so the hash search can jump right
+ * over them, and it can use the recorded strong sums instead of computing
+ * them itself.  The search still makes all the choices about what matches
+ * (including the want_i preference), so the token stream is identical to
+ * a single-threaded search no matter where the range boundaries fall. */
+#define SEARCH_RANGE_SIZE (1024*1024)
+#define MAX_SEARCH_RECS (SEARCH_RANGE_SIZE / 64)
+
+struct search_rec {
+	OFF_T offset;	 /* a candidate offset, or the end of the range */
+	OFF_T free_from; /* no candidates from here up to offset */
+	int has_sum2;	 /* only the end-of-range record lacks a sum2 */
+	char sum2[SUM_LENGTH];
+};
+
+struct search_range {
+	OFF_T start, stop;
+	struct search_rec *recs;
+	int cnt;
+};
+
+static struct {
+	struct sum_struct *s;
+	schar *map;	/* the data starting at seg_start */
+	OFF_T seg_start, seg_end, len;
+	int nranges, cur_range, cur_rec;
+	struct search_range ranges[MAX_CHECKSUM_THREADS];
+} ahead;
+
 
 /**
  * Transmit a literal and/or match token.
@@ -138,20 +290,175 @@ static void matched(int f, struct sum_struct *s, struct map_struct *buf,
 }
 
 
+/* Search one range of offsets for candidate blocks.  This follows the same
+ * path through the data that hash_search() would if it started at the
+ * range's start, and records what it finds for hash_search() to use. */
+static void search_range(struct search_range *r)
+{
+	struct sum_struct *s = ahead.s;
+	OFF_T offset = r->start, after = r->start, len = ahead.len;
+	schar *map = ahead.map + (offset - ahead.seg_start);
+	struct search_rec *rec;
+	uint32 sum, t;
+	int32 j, j_end, k;
+
+	k = (int32)MIN((OFF_T)s->blength, len - offset);
+	sum = get_checksum1((char *)map, k);
+	r->cnt = 0;
+
+	while (offset < r->stop) {
+		t = filter_hash(sum);
+		if (!FILTER_HAS(t))
+			j = j_end = 0;
+		else {
+			if (tablesize == TRADITIONAL_TABLESIZE)
+				t = SUM2HASH(sum);
+			else
+				t = BIG_SUM2HASH(sum);
+			j = hash_table[t];
+			j_end = hash_table[t+1];
+		}
+		for ( ; j < j_end; j++) {
+			if (sum == hash_entries[j].sum1
+			 && k == s->sums[hash_entries[j].i].len)
+				break;
+		}
+
+		if (j < j_end) {
+			if (r->cnt == MAX_SEARCH_RECS - 1) {
+				/* Leave the rest to hash_search(). */
+				r->stop = offset;
+				break;
+			}
+			rec = &r->recs[r->cnt++];
+			rec->offset = offset;
+			rec->free_from = after;
+			rec->has_sum2 = 1;
+			get_checksum2((char *)map, k, rec->sum2);
+
+			for ( ; j < j_end; j++) {
+				int32 i = hash_entries[j].i;
+				if (sum == hash_entries[j].sum1 && k == s->sums[i].len
+				 && memcmp(rec->sum2, sum2_at(s, i), s->s2length) == 0)
+					break;
+			}
+			if (j < j_end) {
+				map += k;
+				offset += k;
+				after = offset;
+				if (offset >= r->stop)
+					break;
+				k = (int32)MIN((OFF_T)s->blength, len - offset);
+				sum = get_checksum1((char *)map, k);
+				continue;
+			}
+			after = offset + 1;
+		}
+
+		if (offset + k < len)
+			sum = roll_sum(s, sum, map, k, 1);
+		else
+			sum = roll_sum(s, sum, map, k--, 0);
+		map++;
+		offset++;
+	}
+
+	rec = &r->recs[r->cnt++];
+	rec->offset = r->stop;
+	rec->free_from = MIN(after, r->stop);
+	rec->has_sum2 = 0;
+}
+
+static void search_ranges(UNUSED(void *arg), int ndx, int cnt)
+{
+	int j;
+
+	for (j = ndx; j < ahead.nranges; j += cnt)
+		search_range(&ahead.ranges[j]);
+}
+
+/* Have the worker threads search the next stretch of the file. */
+static void search_ahead(struct sum_struct *s, struct map_struct *buf,
+			 OFF_T offset, OFF_T len, OFF_T end)
+{
+	int j;
+
+	ahead.s = s;
+	ahead.len = len;
+	ahead.seg_start = offset;
+	ahead.seg_end = MIN(end, offset + (OFF_T)checksum_threads * SEARCH_RANGE_SIZE);
+	ahead.map = (schar *)map_ptr(buf, offset,
+		(int32)(MIN(len, ahead.seg_end + s->blength) - offset));
+
+	for (j = 0; offset < ahead.seg_end; j++, offset += SEARCH_RANGE_SIZE) {
+		struct search_range *r = &ahead.ranges[j];
+		if (!r->recs && !(r->recs = new_array(struct search_rec, MAX_SEARCH_RECS)))
+			out_of_memory("search_ahead");
+		r->start = offset;
+		r->stop = MIN(offset + SEARCH_RANGE_SIZE, ahead.seg_end);
+	}
+	ahead.nranges = j;
+	ahead.cur_range = ahead.cur_rec = 0;
+
+	run_workers(ahead.nranges, search_ranges, NULL);
+}
+
+/* Return the first record that tells us something about offset or beyond. */
+static struct search_rec *find_search_rec(OFF_T offset)
+{
+	while (ahead.cur_range < ahead.nranges) {
+		struct search_range *r = &ahead.ranges[ahead.cur_range];
+		while (ahead.cur_rec < r->cnt) {
+			struct search_rec *rec = &r->recs[ahead.cur_rec];
+			if (rec->offset > offset
+			 || (rec->offset == offset && rec->has_sum2))
+				return rec;
+			ahead.cur_rec++;
+		}
+		ahead.cur_range++;
+		ahead.cur_rec = 0;
+	}
+	return NULL;
+}
+
+/* Do what the hash_search() loop does for the offsets from..to-1 when none
+ * of them has a candidate block: send the literal data as it piles up. */
+static void skip_literals(int f, struct sum_struct *s, struct map_struct *buf,
+			  OFF_T from, OFF_T to, OFF_T end)
+{
+	while (1) {
+		OFF_T o = MAX(from, last_match + s->blength + CHUNK_SIZE);
+		if (o >= to || end - o <= CHUNK_SIZE)
+			break;
+		matched(f, s, buf, o - s->blength, -2);
+		from = o + 1;
+	}
+}
+
+
 static void hash_search(int f,struct sum_struct *s,
 			struct map_struct *buf, OFF_T len)
 {
 	OFF_T offset, end;
 	int32 k, want_i, backup;
 	char sum2[SUM_LENGTH];
-	uint32 s1, s2, sum;
-	int more;
+	uint32 sum, t;
+	int more, use_ahead;
 	schar *map;
 
 	/* want_i is used to encourage adjacent matches, allowing the RLL
 	 * coding of the output to work more efficiently. */
 	want_i = 0;
 
+	/* The in-place checks depend on what has already matched, so the
+	 * search-ahead threads can't be used with them. */
+	use_ahead = checksum_threads > 1 && !updating_basis_file
+		 && len > 2 * SEARCH_RANGE_SIZE;
+	ahead.seg_end = 0;
+
+	if ((rolling_crc = rolling_checksum_type() == RSUM_CRC32C) != 0)
+		crc32c_roll_init(s->blength);
+
 	if (verbose > 2) {
 		rprintf(FINFO, "hash search b=%ld len=%.0f\n",
 			(long)s->blength, (double)len);
@@ -162,8 +469,6 @@ static void hash_search(int f,struct sum_struct *s,
 	map = (schar *)map_ptr(buf, 0, k);
 
 	sum = get_checksum1((char *)map, k);
-	s1 = sum & 0xFFFF;
-	s2 = sum >> 16;
 	if (verbose > 3)
 		rprintf(FINFO, "sum=%.8x k=%ld\n", sum, (long)k);
 
@@ -178,29 +483,54 @@ static void hash_search(int f,struct sum_struct *s,
 
 	do {
 		int done_csum2 = 0;
-		int32 i;
+		int32 i, j, j_end;
+
+		if (use_ahead) {
+			struct search_rec *rec;
+			if (offset >= ahead.seg_end)
+				search_ahead(s, buf, offset, len, end);
+			rec = find_search_rec(offset);
+			if (rec && rec->free_from <= offset
+			 && rec->offset - offset >= s->blength) {
+				skip_literals(f, s, buf, offset, rec->offset, end);
+				if ((offset = rec->offset) >= end)
+					break;
+				k = (int32)MIN((OFF_T)s->blength, len-offset);
+				map = (schar *)map_ptr(buf, offset, k);
+				sum = get_checksum1((char *)map, k);
+			}
+			if (rec && rec->offset == offset && rec->has_sum2) {
+				memcpy(sum2, rec->sum2, sizeof sum2);
+				done_csum2 = 1;
+			}
+		}
 
 		if (verbose > 4) {
-			rprintf(FINFO, "offset=%.0f sum=%04x%04x\n",
-				(double)offset, s2 & 0xFFFF, s1 & 0xFFFF);
+			rprintf(FINFO, "offset=%.0f sum=%08x\n",
+				(double)offset, sum);
 		}
 
-		if (tablesize == TRADITIONAL_TABLESIZE) {
-			if ((i = hash_table[SUM2HASH2(s1,s2)]) < 0)
-				goto null_hash;
-			sum = (s1 & 0xffff) | (s2 << 16);
-		} else {
-			sum = (s1 & 0xffff) | (s2 << 16);
-			if ((i = hash_table[BIG_SUM2HASH(sum)]) < 0)
-				goto null_hash;
+		t = filter_hash(sum);
+		if (!FILTER_HAS(t)) {
+			filter_misses++;
+			goto null_hash;
 		}
+		filter_hits++;
+
+		if (tablesize == TRADITIONAL_TABLESIZE)
+			t = SUM2HASH(sum);
+		else
+			t = BIG_SUM2HASH(sum);
+		if ((j = hash_table[t]) == (j_end = hash_table[t+1]))
+			goto null_hash;
 
 		hash_hits++;
-		do {
+		for ( ; j < j_end; j++) {
 			int32 l;
 
-			if (sum != s->sums[i].sum1)
+			if (sum != hash_entries[j].sum1)
 				continue;
+			i = hash_entries[j].i;
 
 			/* also make sure the two blocks are the same length */
 			l = (int32)MIN((OFF_T)s->blength, len-offset);
@@ -225,7 +555,7 @@ static void hash_search(int f,struct sum_struct *s,
 				done_csum2 = 1;
 			}
 
-			if (memcmp(sum2,s->sums[i].sum2,s->s2length) != 0) {
+			if (memcmp(sum2, sum2_at(s, i), s->s2length) != 0) {
 				false_alarms++;
 				continue;
 			}
@@ -234,14 +564,15 @@ static void hash_search(int f,struct sum_struct *s,
 			 * one with an identical offset, so we prefer that over
 			 * the following want_i optimization. */
 			if (updating_basis_file) {
-				int32 i2;
-				for (i2 = i; i2 >= 0; i2 = s->sums[i2].chain) {
+				int32 j2;
+				for (j2 = j; j2 < j_end; j2++) {
+					int32 i2 = hash_entries[j2].i;
 					if (s->sums[i2].offset != offset)
 						continue;
 					if (i2 != i) {
-						if (sum != s->sums[i2].sum1)
+						if (sum != hash_entries[j2].sum1)
 							break;
-						if (memcmp(sum2, s->sums[i2].sum2,
+						if (memcmp(sum2, sum2_at(s, i2),
 							   s->s2length) != 0)
 							break;
 						i = i2;
@@ -258,8 +589,8 @@ static void hash_search(int f,struct sum_struct *s,
 			if (i != want_i && want_i < s->count
 			    && (!updating_basis_file || s->sums[want_i].offset >= offset
 			     || s->sums[want_i].flags & SUMFLG_SAME_OFFSET)
-			    && sum == s->sums[want_i].sum1
-			    && memcmp(sum2, s->sums[want_i].sum2, s->s2length) == 0) {
+			    && sum == s->sum1_array[want_i]
+			    && memcmp(sum2, sum2_at(s, want_i), s->s2length) == 0) {
 				/* we've found an adjacent match - the RLL coder
 				 * will be happy */
 				i = want_i;
@@ -272,11 +603,9 @@ static void hash_search(int f,struct sum_struct *s,
 			k = (int32)MIN((OFF_T)s->blength, len-offset);
 			map = (schar *)map_ptr(buf, offset, k);
 			sum = get_checksum1((char *)map, k);
-			s1 = sum & 0xFFFF;
-			s2 = sum >> 16;
 			matches++;
 			break;
-		} while ((i = s->sums[i].chain) >= 0);
+		}
 
 	  null_hash:
 		backup = (int32)(offset - last_match);
@@ -284,18 +613,13 @@ static void hash_search(int f,struct sum_struct *s,
 		if (backup < 0)
 			backup = 0;
 
-		/* Trim off the first byte from the checksum */
+		/* Trim off the first byte from the checksum and add on the
+		 * next byte (if there is one). */
 		more = offset + k < len;
 		map = (schar *)map_ptr(buf, offset - backup, k + more + backup)
 		    + backup;
-		s1 -= map[0] + CHAR_OFFSET;
-		s2 -= k * (map[0]+CHAR_OFFSET);
-
-		/* Add on the next byte (if there is one) to the checksum */
-		if (more) {
-			s1 += map[k] + CHAR_OFFSET;
-			s2 += s1;
-		} else
+		sum = roll_sum(s, sum, map, k, more);
+		if (!more)
 			--k;
 
 		/* By matching early we avoid re-reading the
@@ -313,6 +637,82 @@ static void hash_search(int f,struct sum_struct *s,
 }
 
 
+/* With --cdc, the sender cuts up its file the same way that the generator
+ * cut up the basis file, so each of our chunks either matches a chunk of
+ * the same length and sums or is sent as literal data -- there is no need
+ * to roll a checksum over every byte. */
+static void cdc_search(int f, struct sum_struct *s, struct map_struct *buf,
+		       OFF_T len)
+{
+	OFF_T offset;
+	int32 n, i, j, j_end, want_i = 0;
+	char sum2[SUM_LENGTH];
+	uint32 sum, t;
+	char *map;
+
+	if (verbose > 2) {
+		rprintf(FINFO, "cdc search avg=%ld len=%.0f\n",
+			(long)s->blength, (double)len);
+	}
+
+	for (offset = 0; offset < len; offset += n) {
+		n = cdc_chunk_len(buf, offset, len - offset, s->blength);
+		map = map_ptr(buf, offset, n);
+		sum = get_checksum1(map, n);
+		i = -1;
+
+		t = filter_hash(sum);
+		if (!FILTER_HAS(t))
+			filter_misses++;
+		else {
+			int done_csum2 = 0;
+
+			filter_hits++;
+			if (tablesize == TRADITIONAL_TABLESIZE)
+				t = SUM2HASH(sum);
+			else
+				t = BIG_SUM2HASH(sum);
+			if ((j = hash_table[t]) < (j_end = hash_table[t+1]))
+				hash_hits++;
+			for ( ; j < j_end; j++) {
+				int32 i2 = hash_entries[j].i;
+				if (sum != hash_entries[j].sum1 || n != s->sums[i2].len)
+					continue;
+				if (!done_csum2) {
+					get_checksum2(map, n, sum2);
+					done_csum2 = 1;
+				}
+				if (memcmp(sum2, sum2_at(s, i2), s->s2length) != 0) {
+					false_alarms++;
+					continue;
+				}
+				i = i2;
+				break;
+			}
+		}
+
+		if (i < 0) {
+			/* Send the literal data while it is still mapped. */
+			matched(f, s, buf, offset + n, -2);
+			continue;
+		}
+
+		/* Prefer the chunk after the last match, for the RLL coder. */
+		if (i != want_i && want_i < s->count && n == s->sums[want_i].len
+		    && sum == s->sum1_array[want_i]
+		    && memcmp(sum2, sum2_at(s, want_i), s->s2length) == 0)
+			i = want_i;
+		want_i = i + 1;
+
+		matched(f, s, buf, offset, i);
+		matches++;
+	}
+
+	matched(f, s, buf, len, -1);
+	map_ptr(buf, len-1, 1);
+}
+
+
 /**
  * Scan through a origin file, looking for sections that match
  * checksums from the generator, and transmit either literal or token
@@ -335,6 +735,8 @@ void match_sums(int f, struct sum_struct *s, struct map_struct *buf, OFF_T len)
 	last_match = 0;
 	false_alarms = 0;
 	hash_hits = 0;
+	filter_hits = 0;
+	filter_misses = 0;
 	matches = 0;
 	data_transfer = 0;
 
@@ -362,12 +764,23 @@ void match_sums(int f, struct sum_struct *s, struct map_struct *buf, OFF_T len)
 	}
 
 	if (len > 0 && s->count > 0) {
+		/* Count the files whose block size the generator adapted
+		 * (this is for --stats when we're the client). */
+		if (adaptive_block_size && !cdc_mode
+		 && s->blength != default_block_size(s->flength))
+			stats.adapted_block_files++;
+		total_blocks += s->count;
+		total_block_bytes += s->flength;
+
 		build_hash_table(s);
 
 		if (verbose > 2)
 			rprintf(FINFO,"built hash table\n");
 
-		hash_search(f, s, buf, len);
+		if (cdc_mode)
+			cdc_search(f, s, buf, len);
+		else
+			hash_search(f, s, buf, len);
 
 		if (verbose > 2)
 			rprintf(FINFO,"done hash search\n");
@@ -388,12 +801,16 @@ void match_sums(int f, struct sum_struct *s, struct map_struct *buf, OFF_T len)
 		rprintf(FINFO,"sending file_sum\n");
 	write_buf(f, file_sum, sum_len);
 
-	if (verbose > 2)
-		rprintf(FINFO, "false_alarms=%d hash_hits=%d matches=%d\n",
-			false_alarms, hash_hits, matches);
+	if (verbose > 2) {
+		rprintf(FINFO,
+			"false_alarms=%d hash_hits=%d filter_hits=%d filter_misses=%d matches=%d\n",
+			false_alarms, hash_hits, filter_hits, filter_misses, matches);
+	}
 
 	total_hash_hits += hash_hits;
 	total_false_alarms += false_alarms;
+	total_filter_hits += filter_hits;
+	total_filter_misses += filter_misses;
 	total_matches += matches;
 	stats.literal_data += data_transfer;
 }
@@ -407,4 +824,12 @@ void match_report(void)
 		"total: matches=%d  hash_hits=%d  false_alarms=%d data=%.0f\n",
 		total_matches, total_hash_hits, total_false_alarms,
 		(double)stats.literal_data);
+	rprintf(FINFO,
+		"total: filter_hits=%d  filter_misses=%d\n",
+		total_filter_hits, total_filter_misses);
+	rprintf(FINFO,
+		"total: blocks=%.0f  avg_block_size=%.0f  adapted_files=%d\n",
+		(double)total_blocks,
+		total_blocks ? (double)total_block_bytes / total_blocks : 0.0,
+		stats.adapted_block_files);
 }
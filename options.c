@@ -105,9 +105,11 @@ int safe_symlinks = 0;
 int copy_unsafe_links = 0;
 int size_only = 0;
 int daemon_bwlimit = 0;
+int daemon_bwlimit_burst = 0;
 int bwlimit = 0;
+int bwlimit_burst = 0;
+int io_buffer_size = 0;
 int fuzzy_basis = 0;
-size_t bwlimit_writemax = 0;
 int ignore_existing = 0;
 int ignore_non_existing = 0;
 int need_messages_from_generator = 0;
@@ -118,6 +120,19 @@ int ignore_errors = 0;
 int modify_window = 0;
 int blocking_io = -1;
 int checksum_seed = 0;
+int checksum_threads = 0;
+int cdc_mode = 0;
+int adaptive_block_size = 0;
+int use_mmap = 0;
+int use_prefetch = 0;
+int use_io_uring = 0;
+int sparse_block = 0;
+int preallocate_files = 0;
+int checksum_cache = 0;
+int drop_cache = 0;
+OFF_T direct_io_min = 0;
+char *checksum_choice = NULL;
+char *rolling_choice = NULL;
 int inplace = 0;
 int delay_updates = 0;
 long block_size = 0; /* "long" because popt can't set an int32. */
@@ -202,7 +217,8 @@ static int refused_delete, refused_archive_part, refused_compress;
 static int refused_partial, refused_progress, refused_delete_before;
 static int refused_delete_during;
 static int refused_inplace, refused_no_iconv;
-static char *max_size_arg, *min_size_arg;
+static char *max_size_arg, *min_size_arg, *direct_io_arg, *io_buffer_arg;
+static char *bwlimit_burst_arg;
 static char tmp_partialdir[] = ".~tmp~";
 
 /** Local address to bind.  As a character string because it's
@@ -317,6 +333,9 @@ void usage(enum logcode F)
   rprintf(F," -q, --quiet                 suppress non-error messages\n");
   rprintf(F,"     --no-motd               suppress daemon-mode MOTD (see manpage caveat)\n");
   rprintf(F," -c, --checksum              skip based on checksum, not mod-time & size\n");
+  rprintf(F,"     --checksum-choice=STR   choose the checksum algorithm\n");
+  rprintf(F,"     --checksum-cache        remember file checksums in .rsyncsums files\n");
+  rprintf(F,"     --rolling-choice=STR    choose the rolling checksum algorithm\n");
   rprintf(F," -a, --archive               archive mode; equals -rlptgoD (no -H,-A,-X)\n");
   rprintf(F,"     --no-OPTION             turn off an implied OPTION (e.g. --no-D)\n");
   rprintf(F," -r, --recursive             recurse into directories\n");
@@ -358,10 +377,20 @@ void usage(enum logcode F)
   rprintf(F,"     --fake-super            store/recover privileged attrs using xattrs\n");
 #endif
   rprintf(F," -S, --sparse                handle sparse files efficiently\n");
+  rprintf(F,"     --sparse-block=SIZE     make runs of SIZE+ zeros into holes with --sparse\n");
+  rprintf(F,"     --preallocate           allocate dest files before writing them\n");
+  rprintf(F,"     --mmap                  read files via mmap() instead of read()\n");
+  rprintf(F,"     --prefetch              read files ahead of use in a separate thread\n");
+  rprintf(F,"     --io-uring              write files via io_uring (when available)\n");
+  rprintf(F,"     --drop-cache            keep the transferred data out of the page cache\n");
+  rprintf(F,"     --direct-io=SIZE        use O_DIRECT for files of SIZE or more\n");
   rprintf(F," -n, --dry-run               perform a trial run with no changes made\n");
   rprintf(F," -W, --whole-file            copy files whole (without delta-xfer algorithm)\n");
   rprintf(F," -x, --one-file-system       don't cross filesystem boundaries\n");
   rprintf(F," -B, --block-size=SIZE       force a fixed checksum block-size\n");
+  rprintf(F,"     --adaptive-block-size   pick block sizes from how similar files changed\n");
+  rprintf(F,"     --checksum-threads=NUM  use NUM threads to compute block checksums\n");
+  rprintf(F,"     --cdc                   use content-defined chunks instead of fixed blocks\n");
   rprintf(F," -e, --rsh=COMMAND           specify the remote shell to use\n");
   rprintf(F,"     --rsync-path=PROGRAM    specify the rsync to run on the remote machine\n");
   rprintf(F,"     --existing              skip creating new files on receiver\n");
@@ -412,6 +441,7 @@ void usage(enum logcode F)
   rprintf(F,"     --port=PORT             specify double-colon alternate port number\n");
   rprintf(F,"     --sockopts=OPTIONS      specify custom TCP options\n");
   rprintf(F,"     --blocking-io           use blocking I/O for the remote shell\n");
+  rprintf(F,"     --io-buffer=SIZE        buffer SIZE bytes of socket I/O at a time\n");
   rprintf(F,"     --stats                 give some file-transfer stats\n");
   rprintf(F," -8, --8-bit-output          leave high-bit chars unescaped in output\n");
   rprintf(F," -h, --human-readable        output numbers in a human-readable format\n");
@@ -424,6 +454,7 @@ void usage(enum logcode F)
   rprintf(F,"     --password-file=FILE    read daemon-access password from FILE\n");
   rprintf(F,"     --list-only             list the files instead of copying them\n");
   rprintf(F,"     --bwlimit=KBPS          limit I/O bandwidth; KBytes per second\n");
+  rprintf(F,"     --bwlimit-burst=SIZE    let --bwlimit send/receive SIZE at once\n");
   rprintf(F,"     --write-batch=FILE      write a batched update to FILE\n");
   rprintf(F,"     --only-write-batch=FILE like --write-batch but w/o updating destination\n");
   rprintf(F,"     --read-batch=FILE       read a batched update from FILE\n");
@@ -446,8 +477,8 @@ enum {OPT_VERSION = 1000, OPT_DAEMON, OPT_SENDER, OPT_EXCLUDE, OPT_EXCLUDE_FROM,
       OPT_FILTER, OPT_COMPARE_DEST, OPT_COPY_DEST, OPT_LINK_DEST, OPT_HELP,
       OPT_INCLUDE, OPT_INCLUDE_FROM, OPT_MODIFY_WINDOW, OPT_MIN_SIZE, OPT_CHMOD,
       OPT_READ_BATCH, OPT_WRITE_BATCH, OPT_ONLY_WRITE_BATCH, OPT_MAX_SIZE,
-      OPT_NO_D, OPT_APPEND, OPT_NO_ICONV,
-      OPT_SERVER, OPT_REFUSED_BASE = 9000};
+      OPT_NO_D, OPT_APPEND, OPT_NO_ICONV, OPT_DIRECT_IO, OPT_IO_BUFFER,
+      OPT_BWLIMIT_BURST, OPT_SERVER, OPT_REFUSED_BASE = 9000};
 
 static struct poptOption long_options[] = {
   /* longName, shortName, argInfo, argPtr, value, descrip, argDesc */
@@ -542,6 +573,18 @@ static struct poptOption long_options[] = {
   {"sparse",          'S', POPT_ARG_VAL,    &sparse_files, 1, 0, 0 },
   {"no-sparse",        0,  POPT_ARG_VAL,    &sparse_files, 0, 0, 0 },
   {"no-S",             0,  POPT_ARG_VAL,    &sparse_files, 0, 0, 0 },
+  {"sparse-block",     0,  POPT_ARG_INT,    &sparse_block, 0, 0, 0 },
+  {"preallocate",      0,  POPT_ARG_VAL,    &preallocate_files, 1, 0, 0 },
+  {"no-preallocate",   0,  POPT_ARG_VAL,    &preallocate_files, 0, 0, 0 },
+  {"mmap",             0,  POPT_ARG_VAL,    &use_mmap, 1, 0, 0 },
+  {"no-mmap",          0,  POPT_ARG_VAL,    &use_mmap, 0, 0, 0 },
+  {"prefetch",         0,  POPT_ARG_VAL,    &use_prefetch, 1, 0, 0 },
+  {"no-prefetch",      0,  POPT_ARG_VAL,    &use_prefetch, 0, 0, 0 },
+  {"io-uring",         0,  POPT_ARG_VAL,    &use_io_uring, 1, 0, 0 },
+  {"no-io-uring",      0,  POPT_ARG_VAL,    &use_io_uring, 0, 0, 0 },
+  {"drop-cache",       0,  POPT_ARG_VAL,    &drop_cache, 1, 0, 0 },
+  {"no-drop-cache",    0,  POPT_ARG_VAL,    &drop_cache, 0, 0, 0 },
+  {"direct-io",        0,  POPT_ARG_STRING, &direct_io_arg, OPT_DIRECT_IO, 0, 0 },
   {"inplace",          0,  POPT_ARG_VAL,    &inplace, 1, 0, 0 },
   {"no-inplace",       0,  POPT_ARG_VAL,    &inplace, 0, 0, 0 },
   {"append",           0,  POPT_ARG_NONE,   0, OPT_APPEND, 0, 0 },
@@ -574,6 +617,10 @@ static struct poptOption long_options[] = {
   {"checksum",        'c', POPT_ARG_VAL,    &always_checksum, 1, 0, 0 },
   {"no-checksum",      0,  POPT_ARG_VAL,    &always_checksum, 0, 0, 0 },
   {"no-c",             0,  POPT_ARG_VAL,    &always_checksum, 0, 0, 0 },
+  {"checksum-choice",  0,  POPT_ARG_STRING, &checksum_choice, 0, 0, 0 },
+  {"checksum-cache",   0,  POPT_ARG_VAL,    &checksum_cache, 1, 0, 0 },
+  {"no-checksum-cache",0,  POPT_ARG_VAL,    &checksum_cache, 0, 0, 0 },
+  {"rolling-choice",   0,  POPT_ARG_STRING, &rolling_choice, 0, 0, 0 },
   {"block-size",      'B', POPT_ARG_LONG,   &block_size, 0, 0, 0 },
   {"compare-dest",     0,  POPT_ARG_STRING, 0, OPT_COMPARE_DEST, 0, 0 },
   {"copy-dest",        0,  POPT_ARG_STRING, 0, OPT_COPY_DEST, 0, 0 },
@@ -606,6 +653,7 @@ static struct poptOption long_options[] = {
   {"no-i",             0,  POPT_ARG_VAL,    &itemize_changes, 0, 0, 0 },
   {"bwlimit",          0,  POPT_ARG_INT,    &bwlimit, 0, 0, 0 },
   {"no-bwlimit",       0,  POPT_ARG_VAL,    &bwlimit, 0, 0, 0 },
+  {"bwlimit-burst",    0,  POPT_ARG_STRING, &bwlimit_burst_arg, OPT_BWLIMIT_BURST, 0, 0 },
   {"backup",          'b', POPT_ARG_VAL,    &make_backups, 1, 0, 0 },
   {"no-backup",        0,  POPT_ARG_VAL,    &make_backups, 0, 0, 0 },
   {"backup-dir",       0,  POPT_ARG_STRING, &backup_dir, 0, 0, 0 },
@@ -645,8 +693,14 @@ static struct poptOption long_options[] = {
   {"password-file",    0,  POPT_ARG_STRING, &password_file, 0, 0, 0 },
   {"blocking-io",      0,  POPT_ARG_VAL,    &blocking_io, 1, 0, 0 },
   {"no-blocking-io",   0,  POPT_ARG_VAL,    &blocking_io, 0, 0, 0 },
+  {"io-buffer",        0,  POPT_ARG_STRING, &io_buffer_arg, OPT_IO_BUFFER, 0, 0 },
   {"protocol",         0,  POPT_ARG_INT,    &protocol_version, 0, 0, 0 },
   {"checksum-seed",    0,  POPT_ARG_INT,    &checksum_seed, 0, 0, 0 },
+  {"adaptive-block-size",0,POPT_ARG_VAL,    &adaptive_block_size, 1, 0, 0 },
+  {"no-adaptive-block-size",0,POPT_ARG_VAL, &adaptive_block_size, 0, 0, 0 },
+  {"checksum-threads", 0,  POPT_ARG_INT,    &checksum_threads, 0, 0, 0 },
+  {"cdc",              0,  POPT_ARG_VAL,    &cdc_mode, 1, 0, 0 },
+  {"no-cdc",           0,  POPT_ARG_VAL,    &cdc_mode, 0, 0, 0 },
   {"server",           0,  POPT_ARG_NONE,   0, OPT_SERVER, 0, 0 },
   {"sender",           0,  POPT_ARG_NONE,   0, OPT_SENDER, 0, 0 },
   /* All the following options switch us into daemon-mode option-parsing. */
@@ -898,6 +952,7 @@ int parse_arguments(int *argc_p, const char ***argv_p)
 	char *ref = lp_refuse_options(module_id);
 	const char *arg, **argv = *argv_p;
 	int argc = *argc_p;
+	OFF_T size;
 	int opt;
 
 	if (ref && *ref)
@@ -1179,6 +1234,40 @@ int parse_arguments(int *argc_p, const char ***argv_p)
 			}
 			break;
 
+		case OPT_DIRECT_IO:
+			if ((direct_io_min = parse_size_arg(&direct_io_arg, 'b')) <= 0) {
+				snprintf(err_buf, sizeof err_buf,
+					"--direct-io value is invalid: %s\n",
+					direct_io_arg);
+				return 0;
+			}
+			drop_cache = 1;
+			break;
+
+		case OPT_IO_BUFFER:
+			size = parse_size_arg(&io_buffer_arg, 'b');
+			if (size < IO_BUFFER_SIZE || size > MAX_IO_BUFFER_SIZE) {
+				snprintf(err_buf, sizeof err_buf,
+					"--io-buffer must be between %d and %d: %s\n",
+					IO_BUFFER_SIZE, MAX_IO_BUFFER_SIZE,
+					io_buffer_arg);
+				return 0;
+			}
+			io_buffer_size = (int)size;
+			break;
+
+		case OPT_BWLIMIT_BURST:
+			size = parse_size_arg(&bwlimit_burst_arg, 'K');
+			if (size < MIN_BWLIMIT_BURST || size > MAX_BWLIMIT_BURST) {
+				snprintf(err_buf, sizeof err_buf,
+					"--bwlimit-burst must be between %d and %d: %s\n",
+					MIN_BWLIMIT_BURST, MAX_BWLIMIT_BURST,
+					bwlimit_burst_arg);
+				return 0;
+			}
+			bwlimit_burst = (int)size;
+			break;
+
 		case OPT_APPEND:
 			if (am_server)
 				append_mode++;
@@ -1515,6 +1604,13 @@ int parse_arguments(int *argc_p, const char ***argv_p)
 		parse_rule(&filter_list, backup_dir_buf, 0, 0);
 	}
 
+	if (checksum_cache && !am_server) {
+		/* Each side keeps its own cache files: they are never sent,
+		 * and never deleted by the receiver. */
+		parse_rule(&filter_list, "H " SUMCACHE_NAME "*", 0, 0);
+		parse_rule(&filter_list, "P " SUMCACHE_NAME "*", 0, 0);
+	}
+
 	if (make_backups && !backup_dir) {
 		omit_dir_times = 0; /* Implied, so avoid -O to sender. */
 		if (preserve_times > 1)
@@ -1569,17 +1665,61 @@ int parse_arguments(int *argc_p, const char ***argv_p)
 
 	if (daemon_bwlimit && (!bwlimit || bwlimit > daemon_bwlimit))
 		bwlimit = daemon_bwlimit;
-	if (bwlimit) {
-		bwlimit_writemax = (size_t)bwlimit * 128;
-		if (bwlimit_writemax < 512)
-			bwlimit_writemax = 512;
+	if (daemon_bwlimit_burst
+	 && (!bwlimit_burst || bwlimit_burst > daemon_bwlimit_burst))
+		bwlimit_burst = daemon_bwlimit_burst;
+
+	if (checksum_choice && !valid_checksum_choice()) {
+		snprintf(err_buf, sizeof err_buf,
+			 "unknown checksum name for --checksum-choice: %s\n",
+			 checksum_choice);
+		return 0;
 	}
 
-	if (sparse_files && inplace) {
-		/* Note: we don't check for this below, because --append is
-		 * OK with --sparse (as long as redos are handled right). */
+	if (rolling_choice && !valid_rolling_choice()) {
 		snprintf(err_buf, sizeof err_buf,
-			 "--sparse cannot be used with --inplace\n");
+			 "unknown rolling checksum name for --rolling-choice: %s\n",
+			 rolling_choice);
+		return 0;
+	}
+
+	if (sparse_block && (sparse_block < 2 || sparse_block > MAX_MAP_SIZE)) {
+		snprintf(err_buf, sizeof err_buf,
+			 "--sparse-block must be between 2 and %d\n", MAX_MAP_SIZE);
+		return 0;
+	}
+
+#ifndef SUPPORT_PREALLOCATION
+	if (preallocate_files && !am_sender) {
+		snprintf(err_buf, sizeof err_buf,
+			 "--preallocate is not supported on this %s\n",
+			 am_server ? "server" : "client");
+		return 0;
+	}
+#endif
+
+	if (checksum_threads < 0 || checksum_threads > MAX_CHECKSUM_THREADS) {
+		snprintf(err_buf, sizeof err_buf,
+			 "--checksum-threads must be between 0 and %d\n",
+			 MAX_CHECKSUM_THREADS);
+		return 0;
+	}
+#ifndef SUPPORT_THREADS
+	if (checksum_threads > 1) {
+		snprintf(err_buf, sizeof err_buf,
+			 "threads are not supported on this %s\n",
+			 am_server ? "server" : "client");
+		return 0;
+	}
+#endif
+
+	if (cdc_mode && (inplace || append_mode || write_batch || read_batch)) {
+		/* The chunks move around, which --inplace can't handle, and
+		 * a batch file doesn't record how the chunks were cut. */
+		snprintf(err_buf, sizeof err_buf,
+			 "--cdc cannot be used with --%s\n",
+			 append_mode ? "append" : inplace ? "inplace"
+			 : write_batch ? "write-batch" : "read-batch");
 		return 0;
 	}
 
@@ -1838,6 +1978,9 @@ void server_options(char **args, int *argc_p)
 		argstr[x++] = 's';
 #endif
 		argstr[x++] = 'f';
+		/* A batch file doesn't record the checksum negotiation. */
+		if (!write_batch)
+			argstr[x++] = 'C';
 	}
 
 	if (x >= (int)sizeof argstr) { /* Not possible... */
@@ -1917,6 +2060,17 @@ void server_options(char **args, int *argc_p)
 		if (asprintf(&arg, "--bwlimit=%d", bwlimit) < 0)
 			goto oom;
 		args[ac++] = arg;
+		if (bwlimit_burst) {
+			if (asprintf(&arg, "--bwlimit-burst=%db", bwlimit_burst) < 0)
+				goto oom;
+			args[ac++] = arg;
+		}
+	}
+
+	if (io_buffer_size) {
+		if (asprintf(&arg, "--io-buffer=%d", io_buffer_size) < 0)
+			goto oom;
+		args[ac++] = arg;
 	}
 
 	if (backup_dir) {
@@ -1987,6 +2141,45 @@ void server_options(char **args, int *argc_p)
 		args[ac++] = arg;
 	}
 
+	if (checksum_threads > 1) {
+		if (asprintf(&arg, "--checksum-threads=%d", checksum_threads) < 0)
+			goto oom;
+		args[ac++] = arg;
+	}
+
+	if (sparse_files && sparse_block) {
+		if (asprintf(&arg, "--sparse-block=%d", sparse_block) < 0)
+			goto oom;
+		args[ac++] = arg;
+	}
+
+	if (preallocate_files && am_sender)
+		args[ac++] = "--preallocate";
+
+	if (checksum_cache)
+		args[ac++] = "--checksum-cache";
+
+	if (cdc_mode)
+		args[ac++] = "--cdc";
+
+	if (adaptive_block_size && !block_size)
+		args[ac++] = "--adaptive-block-size";
+
+	if (use_mmap)
+		args[ac++] = "--mmap";
+
+	if (use_prefetch)
+		args[ac++] = "--prefetch";
+
+	if (use_io_uring)
+		args[ac++] = "--io-uring";
+
+	if (direct_io_min) {
+		args[ac++] = "--direct-io";
+		args[ac++] = direct_io_arg;
+	} else if (drop_cache)
+		args[ac++] = "--drop-cache";
+
 	if (partial_dir && am_sender) {
 		if (partial_dir != tmp_partialdir) {
 			args[ac++] = "--partial-dir";
@@ -21,9 +21,31 @@ void write_stream_flags(int fd);
 void read_stream_flags(int fd);
 void check_batch_flags(void);
 void write_batch_shell_file(int argc, char *argv[], int file_arg_cnt);
+size_t bwlimit_max_io(size_t len);
+void bwlimit_account(int dir, size_t bytes);
+void bwlimit_shared_init(void);
+void bwlimit_shared_join(const char *module, int module_kbps, int daemon_kbps);
+int bwlimit_shared_status(void);
+int32 cdc_avg_size(int32 blength);
+int32 cdc_chunk_len(struct map_struct *buf, OFF_T offset, OFF_T remaining,
+		    int32 avg);
+int cdc_find_chunk(struct cdc_index *ci, struct map_struct *buf, OFF_T size,
+		   int32 avg, int32 i, OFF_T *offset_p, int32 *len_p);
+int checksum_type(void);
+int valid_checksum_choice(void);
+int valid_rolling_choice(void);
+const char *checksum_names(void);
+const char *rolling_checksum_names(void);
+int choose_checksum(const char *client_list, const char *server_list);
+int choose_rolling_checksum(const char *client_list, const char *server_list);
+const char *checksum_name(void);
+const char *rolling_checksum_name(void);
+int rolling_checksum_type(void);
+int checksum_digest_len(void);
 uint32 get_checksum1(char *buf1, int32 len);
 void get_checksum2(char *buf, int32 len, char *sum);
-void file_checksum(char *fname, char *sum, OFF_T size);
+void get_checksum2_multi(char **bufs, int32 len, int cnt, char **sums);
+int file_checksum(char *fname, char *sum, OFF_T size);
 void sum_init(int seed);
 void sum_update(const char *p, int32 len);
 int sum_end(char *sum);
@@ -59,6 +81,10 @@ int daemon_main(void);
 void set_allow_inc_recurse(void);
 void setup_protocol(int f_out,int f_in);
 int claim_connection(char *fname, int max_connections);
+void evloop_add(int fd, int events);
+int evloop_wait(int secs);
+int evloop_ready(int fd);
+void evloop_reset(void);
 void set_filter_dir(const char *dir, unsigned int dirlen);
 void *push_local_filters(const char *dir, unsigned int dirlen);
 void pop_local_filters(void *mem);
@@ -73,9 +99,14 @@ char *get_rule_prefix(int match_flags, const char *pat, int for_xfer,
 		      unsigned int *plen_ptr);
 void send_filter_list(int f_out);
 void recv_filter_list(int f_in);
+int sparse_flush(int f);
 int sparse_end(int f);
+void set_sparse_block(int f);
+int begin_write_file(int f, OFF_T size);
+int end_write_file(int f);
 int flush_write_file(int f);
 int write_file(int f, char *buf, int len);
+int mmap_fault_in(const char *buf, size_t len);
 struct map_struct *map_file(int fd, OFF_T len, int32 read_size,
 			    int32 blk_size);
 char *map_ptr(struct map_struct *map, OFF_T offset, int32 len);
@@ -106,6 +137,8 @@ void itemize(const char *fnamecmp, struct file_struct *file, int ndx, int statre
 	     stat_x *sxp, int32 iflags, uchar fnamecmp_type,
 	     const char *xname);
 int unchanged_file(char *fn, struct file_struct *file, STRUCT_STAT *st);
+void note_literal_runs(int ndx, int32 runs);
+int32 default_block_size(int64 len);
 void check_for_finished_files(int itemizing, enum logcode code, int check_redo);
 void generate_files(int f_out, const char *local_name);
 struct hashtable *hashtable_create(int size, int key64);
@@ -179,9 +212,13 @@ void io_end_multiplex_out(void);
 void start_write_batch(int fd);
 void stop_write_batch(void);
 char *lp_bind_address(void);
+char *lp_bwlimit_status_file(void);
 char *lp_motd_file(void);
 char *lp_pid_file(void);
 char *lp_socket_options(void);
+int lp_daemon_bwlimit(void);
+int lp_prefork_sessions(void);
+int lp_prefork_workers(void);
 int lp_rsync_port(void);
 char *lp_auth_users(int module_id);
 char *lp_charset(int module_id);
@@ -208,8 +245,11 @@ char *lp_refuse_options(int module_id);
 char *lp_secrets_file(int module_id);
 char *lp_temp_dir(int module_id);
 char *lp_uid(int module_id);
+int lp_bwlimit(int module_id);
+int lp_bwlimit_burst(int module_id);
 int lp_max_connections(int module_id);
 int lp_max_verbosity(int module_id);
+int lp_module_bwlimit(int module_id);
 int lp_syslog_facility(int module_id);
 int lp_timeout(int module_id);
 BOOL lp_fake_super(int module_id);
@@ -285,6 +325,13 @@ struct file_list *flist_for_ndx(int ndx, const char *fatal_error_loc);
 const char *who_am_i(void);
 void successful_send(int ndx);
 void send_files(int f_in, int f_out);
+int set_simd_checksum1(const char *name);
+int32 get_checksum1_simd(schar *buf, int32 len, uint32 *ps1, uint32 *ps2);
+int32 get_crc32c_simd(uint32 *pcrc, const uchar *buf, int32 len);
+int set_simd_zeros(const char *name);
+int32 count_zeros_simd(const char *buf, int32 len);
+void md_lanes_sse2(int use_md5, char **bufs, int32 len,
+		   const uchar *seedbuf, int seedlen, char **sums);
 int try_bind_local(int s, int ai_family, int ai_socktype,
 		   const char *bind_addr);
 int open_socket_out(char *host, int port, const char *bind_addr,
@@ -293,7 +340,12 @@ int open_socket_out_wrapped(char *host, int port, const char *bind_addr,
 			    int af_hint);
 int is_a_socket(int fd);
 void start_accept_loop(int port, int (*fn)(int, int));
+void start_worker_pool(int port, int workers, int sessions,
+		       int (*fn)(int, int), int (*worker_ok)(void));
 void set_socket_options(int fd, char *options);
+int sumcache_lookup(const char *fname, STRUCT_STAT *st, char *sum);
+void sumcache_store(const char *fname, STRUCT_STAT *st, const char *sum);
+void cached_file_checksum(char *fname, STRUCT_STAT *st, char *sum);
 int do_unlink(const char *fname);
 int do_symlink(const char *fname1, const char *fname2);
 int do_link(const char *fname1, const char *fname2);
@@ -309,6 +361,7 @@ int do_mkstemp(char *template, mode_t perms);
 int do_stat(const char *fname, STRUCT_STAT *st);
 int do_lstat(const char *fname, STRUCT_STAT *st);
 int do_fstat(int fd, STRUCT_STAT *st);
+int do_fallocate(int fd, OFF_T offset, OFF_T length, int keep_size);
 OFF_T do_lseek(int fd, OFF_T offset, int whence);
 void set_compression(const char *fname);
 void send_token(int f, int32 token, struct map_struct *buf, OFF_T offset,
@@ -323,6 +376,10 @@ void send_id_list(int f);
 uid_t recv_user_name(int f, uid_t uid);
 gid_t recv_group_name(int f, gid_t gid, uint16 *flags_ptr);
 void recv_id_list(int f, struct file_list *flist);
+int uring_init(size_t size);
+char *uring_buffer(void);
+char *uring_write(int fd, char *buf, size_t len);
+int uring_wait(int fd);
 void set_nonblocking(int fd);
 void set_blocking(int fd);
 int fd_pair(int fd[2]);
@@ -333,6 +390,8 @@ int set_modtime(const char *fname, time_t modtime, mode_t mode);
 int mkdir_defmode(char *fname);
 int create_directory_path(char *fname);
 int full_write(int desc, const char *ptr, size_t len);
+OFF_T copy_range(int fd_in, OFF_T offset, int f, OFF_T len);
+int can_copy_range(void);
 int copy_file(const char *source, const char *dest, int ofd,
 	      mode_t mode, int create_bak_dir);
 int robust_unlink(const char *fname);
@@ -377,6 +436,7 @@ void flist_ndx_push(flist_ndx_list *lp, int ndx);
 int flist_ndx_pop(flist_ndx_list *lp);
 void *expand_item_list(item_list *lp, size_t item_size,
 		       const char *desc, int incr);
+void run_workers(int cnt, void (*fn)(void *arg, int ndx, int cnt), void *arg);
 void free_xattr(stat_x *sxp);
 int get_xattr(const char *fname, stat_x *sxp);
 int copy_xattrs(const char *source, const char *dest);
@@ -44,11 +44,14 @@ extern int make_backups;
 extern int cleanup_got_literal;
 extern int remove_source_files;
 extern int append_mode;
+extern int cdc_mode;
+extern int adaptive_block_size;
 extern int sparse_files;
 extern int keep_partial;
 extern int checksum_seed;
 extern int inplace;
 extern int delay_updates;
+extern int checksum_cache;
 extern mode_t orig_umask;
 extern struct stats stats;
 extern char *tmpdir;
@@ -62,6 +65,8 @@ static int phase = 0, redoing = 0;
 static flist_ndx_list batch_redo_list;
 /* We're either updating the basis file or an identical copy: */
 static int updating_basis_or_equiv;
+static int32 literal_runs; /* -1 if receive_data() had no basis file */
+static char file_sum1[MAX_DIGEST_LEN]; /* the sum of what receive_data() wrote */
 
 /*
  * get_tmpname() - create a tmp filename for a given filename
@@ -162,21 +167,68 @@ int open_tmpfile(char *fnametmp, const char *fname, struct file_struct *file)
 	return fd;
 }
 
+/* Have the kernel copy the run of matched basis data that receive_data()
+ * has been saving up (see copy_range()).  Anything that it doesn't copy
+ * gets written from the basis file's map, and *copy_ok_ptr gets cleared
+ * so that the rest of the file is written from the map as it goes.  The
+ * bytes that the kernel copied are added to *copied_ptr. */
+static int write_matched_run(struct map_struct *mapbuf, int fd_r, int fd,
+			     OFF_T offset, OFF_T len, int *copy_ok_ptr,
+			     OFF_T *copied_ptr)
+{
+	OFF_T done;
+
+	if (flush_write_file(fd) < 0)
+		return -1;
+	if ((done = copy_range(fd_r, offset, fd, len)) < len)
+		*copy_ok_ptr = 0;
+	*copied_ptr += done;
+
+	while (done < len) {
+		int32 n = (int32)MIN(len - done, MAX_MAP_SIZE);
+		if (write_file(fd, map_ptr(mapbuf, offset + done, n), n) != n)
+			return -1;
+		done += n;
+	}
+
+	return 0;
+}
+
+/* The data that the kernel copies isn't the data that we checksummed, so
+ * if the basis file changed while we were at it, the file has to be
+ * redone. */
+static int basis_changed(int fd_r, STRUCT_STAT *st_r)
+{
+	STRUCT_STAT st;
+
+	return do_fstat(fd_r, &st) < 0
+	    || st.st_size != st_r->st_size
+	    || st.st_mtime != st_r->st_mtime
+	    || ST_MTIME_NSEC(&st) != ST_MTIME_NSEC(st_r)
+	    || st.st_ctime != st_r->st_ctime
+	    || ST_CTIME_NSEC(&st) != ST_CTIME_NSEC(st_r);
+}
+
 static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 			const char *fname, int fd, OFF_T total_size)
 {
-	static char file_sum1[MAX_DIGEST_LEN];
 	static char file_sum2[MAX_DIGEST_LEN];
+	static struct cdc_index cdc;
 	struct map_struct *mapbuf;
 	struct sum_struct sum;
 	int32 len, sum_len;
 	OFF_T offset = 0;
 	OFF_T offset2;
+	OFF_T run_offset = 0, run_len = 0, copied = 0;
+	OFF_T streak_end = -1, streak_len = 0, prior_len;
+	STRUCT_STAT st_r;
 	char *data;
 	int32 i;
 	char *map = NULL;
+	int cdc_ok = 1, in_literal = 0, copy_ok;
 
 	read_sum_head(f_in, &sum);
+	cdc.cnt = 0;
 
 	if (fd_r >= 0 && size_r > 0) {
 		int32 read_size = MAX(sum.blength * 2, 16*1024);
@@ -187,6 +239,19 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 		}
 	} else
 		mapbuf = NULL;
+	literal_runs = mapbuf ? 0 : -1;
+
+	/* Once a streak of contiguous matched blocks reaches COPY_RANGE_MIN
+	 * bytes (which get written from the map, like any other), the rest of
+	 * it gets saved up into a run that the kernel can copy in one go.
+	 * (An --inplace update mostly has nothing to copy, and --sparse needs
+	 * to see the zeros.) */
+	copy_ok = fd != -1 && mapbuf && !inplace && sparse_files <= 0
+	       && can_copy_range() && do_fstat(fd_r, &st_r) == 0;
+	if (fd != -1 && begin_write_file(fd, total_size))
+		copy_ok = 0;
+	if (sparse_files > 0 && fd != -1)
+		set_sparse_block(fd);
 
 	sum_init(checksum_seed);
 
@@ -230,9 +295,21 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 
 			stats.literal_data += i;
 			cleanup_got_literal = 1;
+			if (!in_literal) {
+				literal_runs++;
+				in_literal = 1;
+			}
 
 			sum_update(data, i);
 
+			if (run_len) {
+				if (write_matched_run(mapbuf, fd_r, fd, run_offset,
+						      run_len, &copy_ok, &copied) < 0)
+					goto report_write_error;
+				run_len = 0;
+			}
+			streak_end = -1;
+			streak_len = 0;
 			if (fd != -1 && write_file(fd,data,i) != i)
 				goto report_write_error;
 			offset += i;
@@ -240,10 +317,22 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 		}
 
 		i = -(i+1);
-		offset2 = i * (OFF_T)sum.blength;
-		len = sum.blength;
-		if (i == (int)sum.count-1 && sum.remainder != 0)
-			len = sum.remainder;
+		in_literal = 0;
+		if (cdc_mode) {
+			/* We have to cut up the basis file to find a --cdc
+			 * chunk.  If that fails, the file changed, so we just
+			 * eat the data and let the file get redone. */
+			if (!mapbuf || !cdc_find_chunk(&cdc, mapbuf, size_r, sum.blength,
+						       i, &offset2, &len)) {
+				cdc_ok = 0;
+				continue;
+			}
+		} else {
+			offset2 = i * (OFF_T)sum.blength;
+			len = sum.blength;
+			if (i == (int)sum.count-1 && sum.remainder != 0)
+				len = sum.remainder;
+		}
 
 		stats.matched_data += len;
 
@@ -253,6 +342,19 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 				i, (long)len, (double)offset2, (double)offset);
 		}
 
+		if (offset2 != streak_end) {
+			if (run_len) {
+				if (write_matched_run(mapbuf, fd_r, fd, run_offset,
+						      run_len, &copy_ok, &copied) < 0)
+					goto report_write_error;
+				run_len = 0;
+			}
+			streak_len = 0;
+		}
+		prior_len = streak_len;
+		streak_len += len;
+		streak_end = offset2 + len;
+
 		if (mapbuf) {
 			map = map_ptr(mapbuf,offset2,len);
 
@@ -263,7 +365,7 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 		if (updating_basis_or_equiv) {
 			if (offset == offset2 && fd != -1) {
 				OFF_T pos;
-				if (flush_write_file(fd) < 0)
+				if (flush_write_file(fd) < 0 || sparse_flush(fd) < 0)
 					goto report_write_error;
 				offset += len;
 				if ((pos = do_lseek(fd, len, SEEK_CUR)) != offset) {
@@ -276,11 +378,18 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 				continue;
 			}
 		}
-		if (fd != -1 && map && write_file(fd, map, len) != (int)len)
+		if (copy_ok && prior_len >= COPY_RANGE_MIN) {
+			if (!run_len)
+				run_offset = offset2;
+			run_len += len;
+		} else if (fd != -1 && map && write_file(fd, map, len) != (int)len)
 			goto report_write_error;
 		offset += len;
 	}
 
+	if (run_len && write_matched_run(mapbuf, fd_r, fd, run_offset,
+					 run_len, &copy_ok, &copied) < 0)
+		goto report_write_error;
 	if (flush_write_file(fd) < 0)
 		goto report_write_error;
 
@@ -295,7 +404,8 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 	if (do_progress)
 		end_progress(total_size);
 
-	if (fd != -1 && offset > 0 && sparse_end(fd) != 0) {
+	if (fd != -1 && ((offset > 0 && sparse_end(fd) != 0)
+		      || end_write_file(fd) != 0)) {
 	    report_write_error:
 		rsyserr(FERROR_XFER, errno, "write failed on %s",
 			full_fname(fname));
@@ -310,8 +420,15 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 	read_buf(f_in, file_sum2, sum_len);
 	if (verbose > 2)
 		rprintf(FINFO,"got file_sum\n");
-	if (fd != -1 && memcmp(file_sum1, file_sum2, sum_len) != 0)
+	if (fd != -1 && (!cdc_ok || memcmp(file_sum1, file_sum2, sum_len) != 0))
+		return 0;
+	if (copied && basis_changed(fd_r, &st_r)) {
+		if (verbose > 1) {
+			rprintf(FINFO, "%s changed while its data was being copied\n",
+				fname_r);
+		}
 		return 0;
+	}
 	return 1;
 }
 
@@ -721,6 +838,14 @@ int recv_files(int f_in, char *local_name)
 		recv_ok = receive_data(f_in, fnamecmp, fd1, st.st_size,
 				       fname, fd2, F_LENGTH(file));
 
+		/* Let the generator learn how this file changed. */
+		if (adaptive_block_size && recv_ok && literal_runs >= 0) {
+			char numbuf[8];
+			SIVAL(numbuf, 0, ndx);
+			SIVAL(numbuf, 4, literal_runs);
+			send_msg(MSG_LITERAL_RUNS, numbuf, 8, 0);
+		}
+
 		log_item(log_code, file, &initial_stats, iflags, NULL);
 
 		if (fd1 != -1)
@@ -737,9 +862,15 @@ int recv_files(int f_in, char *local_name)
 			if (!finish_transfer(fname, fnametmp, fnamecmp,
 					     partialptr, file, recv_ok, 1))
 				recv_ok = -1;
-			else if (fnamecmp == partialptr) {
-				do_unlink(partialptr);
-				handle_partial_dir(partialptr, PDIR_DELETE);
+			else {
+				if (fnamecmp == partialptr) {
+					do_unlink(partialptr);
+					handle_partial_dir(partialptr, PDIR_DELETE);
+				}
+				/* A later --checksum run won't have to read
+				 * the file we just wrote. */
+				if (checksum_cache && recv_ok == 1)
+					sumcache_store(fname, NULL, file_sum1);
 			}
 		} else if (keep_partial && partialptr) {
 			if (!handle_partial_dir(partialptr, PDIR_CREATE)) {
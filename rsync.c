@@ -346,6 +346,8 @@ int read_ndx_and_attrs(int f_in, int *iflag_ptr, uchar *type_ptr,
 void free_sums(struct sum_struct *s)
 {
 	if (s->sums) free(s->sums);
+	if (s->sum1_array) free(s->sum1_array);
+	if (s->sum2_array) free(s->sum2_array);
 	free(s);
 }
 
@@ -123,12 +123,25 @@
 
 #define RSYNC_PORT 873
 
-#define SPARSE_WRITE_SIZE (1024)
+#define SPARSE_MIN_HOLE (1024) /* the default --sparse-block is the fs block */
+#define SPARSE_MAX_HOLE (64*1024) /* size, kept between these two sizes */
 #define WRITE_SIZE (32*1024)
 #define CHUNK_SIZE (32*1024)
+#define COPY_RANGE_MIN (64*1024) /* the smallest run that the kernel copies */
 #define MAX_MAP_SIZE (256*1024)
+#define WRITE_BUF_SIZE (1024*1024) /* the receiver's write buffer for a big file */
+#define MAX_WRITE_BUF_SIZE (8*1024*1024)
+#define SUMCACHE_NAME ".rsyncsums" /* the --checksum-cache file in each dir */
+#define DROP_CACHE_STEP (8*1024*1024) /* how often --drop-cache drops data */
 #define IO_BUFFER_SIZE (4092)
+#define MAX_IO_BUFFER_SIZE (8*1024*1024) /* the largest --io-buffer */
+#define MIN_BWLIMIT_BURST 512
+#define MAX_BWLIMIT_BURST (1024*1024*1024)
 #define MAX_BLOCK_SIZE ((int32)1 << 17)
+#define CSUM2_LANES 4 /* blocks that get_checksum2_multi() can hash at once */
+#define MAX_CHECKSUM_THREADS 64
+#define CDC_MIN_AVG (2*1024) /* the average --cdc chunk sizes (see cdc.c) */
+#define CDC_MAX_AVG (MAX_BLOCK_SIZE / 4)
 
 /* For compatibility with older rsyncs */
 #define OLD_MAX_BLOCK_SIZE ((int32)1 << 29)
@@ -142,6 +155,7 @@
 #define MAX_SERVER_ARGS (MAX_BASIS_DIRS*2 + 100)
 
 #define MPLEX_BASE 7
+#define MAX_MPLEX_DATA 0xFFFFFF /* the length field of a message header */
 
 #define NO_FILTERS	0
 #define SERVER_FILTERS	1
@@ -159,6 +173,12 @@
 #define FULL_FLUSH	1
 #define NORMAL_FLUSH	0
 
+#define EVL_READ	(1<<0)
+#define EVL_WRITE	(1<<1)
+
+#define BWL_OUT		0
+#define BWL_IN		1
+
 #define PDIR_CREATE	1
 #define PDIR_DELETE	0
 
@@ -233,6 +253,7 @@ enum msgcode {
 	MSG_SUCCESS=100,/* successfully updated indicated flist index */
 	MSG_DELETED=101,/* successfully deleted a file on receiving side */
 	MSG_NO_SEND=102,/* sender failed to open a file we wanted */
+	MSG_LITERAL_RUNS=103,/* receiver's count of literal runs in a file */
 	MSG_DONE=86	/* current phase is done */
 };
 
@@ -339,6 +360,10 @@ enum msgcode {
 #include <sys/select.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 #ifdef HAVE_SYS_MODE_H
 /* apparently AIX needs this for S_ISLNK */
 #ifndef S_ISLNK
@@ -397,6 +422,11 @@ enum msgcode {
 # include <limits.h>
 #endif
 
+#if defined HAVE_PTHREAD_H && defined HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#define SUPPORT_THREADS 1
+#endif
+
 #if defined USE_ICONV_OPEN && defined HAVE_ICONV_H
 #include <iconv.h>
 #ifndef ICONV_CONST
@@ -520,6 +550,14 @@ typedef unsigned int size_t;
 #define SIZEOF_CAPITAL_OFF_T SIZEOF_OFF64_T
 #endif
 
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+#define ST_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#define ST_CTIME_NSEC(st) ((st)->st_ctim.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) 0
+#define ST_CTIME_NSEC(st) 0
+#endif
+
 /* CAVEAT: on some systems, int64 will really be a 32-bit integer IFF
  * that's the maximum size the file system can handle and there is no
  * 64-bit type available.  The rsync source must therefore take steps
@@ -559,6 +597,45 @@ typedef unsigned int size_t;
 # define SIZEOF_INT64 SIZEOF_OFF_T
 #endif
 
+#ifndef uint64
+#if SIZEOF_UINT64_T == 8
+# define uint64 uint64_t
+#elif SIZEOF_LONG == 8
+# define uint64 unsigned long
+#elif SIZEOF_LONG_LONG == 8
+# define uint64 unsigned long long
+#endif
+#endif
+
+/* The XXH64 checksum needs a real 64-bit unsigned type. */
+#ifdef uint64
+#define SUPPORT_XXH64 1
+#endif
+
+/* The --mmap file access needs a SIGBUS handler that gets the fault address
+ * and that can (on Linux) safely call mmap() -- see fileio.c. */
+#if defined HAVE_MMAP && defined HAVE_SYS_MMAN_H && defined HAVE_SIGACTION \
+ && defined SA_SIGINFO && defined __linux__
+#define SUPPORT_MMAP 1
+#endif
+
+/* The --preallocate option reserves a file's space before it is written. */
+#if defined HAVE_FALLOCATE || defined HAVE_POSIX_FALLOCATE
+#define SUPPORT_PREALLOCATION 1
+#endif
+
+/* The --direct-io reads and writes need buffers aligned for O_DIRECT. */
+#if defined O_DIRECT && defined HAVE_POSIX_MEMALIGN
+#define SUPPORT_DIRECT_IO 1
+#define DIRECT_IO_ALIGN 4096
+#endif
+
+/* The --io-uring writes use raw io_uring system calls and GCC atomics. */
+#if defined HAVE_LINUX_IO_URING_H && defined HAVE_SYS_SYSCALL_H \
+ && defined HAVE_MMAP && defined __GNUC__
+#define SUPPORT_IO_URING 1
+#endif
+
 struct hashtable {
 	void *nodes;
 	int32 size, entries;
@@ -596,6 +673,17 @@ struct ht_int64_node {
 #define SHORT_SUM_LENGTH 2
 #define BLOCKSUM_BIAS 10
 
+#define MAX_NSTR_LEN 256 /* the longest list of names we negotiate */
+
+/* The strong-checksum algorithms (see the table in checksum.c). */
+#define CSUM_MD4 1
+#define CSUM_MD5 2
+#define CSUM_XXH64 3
+
+/* The rolling-checksum algorithms (see the table in checksum.c). */
+#define RSUM_ADLER 1
+#define RSUM_CRC32C 2
+
 #ifndef MAXPATHLEN
 #define MAXPATHLEN 1024
 #endif
@@ -754,24 +842,34 @@ struct file_list {
 
 #define SUMFLG_SAME_OFFSET	(1<<0)
 
+/* The checksums are kept in separate arrays (rather than all together in
+ * the sum_buf) so that the hash search only pulls the data it is actually
+ * comparing into the cache. */
 struct sum_buf {
 	OFF_T offset;		/**< offset in file of this chunk */
 	int32 len;		/**< length of chunk of file */
-	uint32 sum1;	        /**< simple checksum */
-	int32 chain;		/**< next hash-table collision */
 	short flags;		/**< flag bits */
-	char sum2[SUM_LENGTH];	/**< checksum  */
 };
 
 struct sum_struct {
 	OFF_T flength;		/**< total file length */
 	struct sum_buf *sums;	/**< points to info for each chunk */
+	uint32 *sum1_array;	/**< simple checksum of each chunk */
+	char *sum2_array;	/**< s2length-byte checksum of each chunk */
 	int32 count;		/**< how many chunks */
 	int32 blength;		/**< block_length */
 	int32 remainder;	/**< flength % block_length */
 	int s2length;		/**< sum2_length */
 };
 
+#define sum2_at(s, i)	((s)->sum2_array + (size_t)(i) * (s)->s2length)
+
+struct cdc_index {
+	OFF_T *offsets;		/* where each --cdc chunk starts (plus the end) */
+	int32 cnt;		/* how many chunks have been found so far */
+	int32 alloc;
+};
+
 struct map_struct {
 	OFF_T file_size;	/* File size (from stat)		*/
 	OFF_T p_offset;		/* Window start				*/
@@ -782,6 +880,12 @@ struct map_struct {
 	int32 def_window_size;	/* Default window size			*/
 	int fd;			/* File Descriptor			*/
 	int status;		/* first errno from read errors		*/
+	char *mmap_base;	/* The whole file, when --mmap is in use */
+	OFF_T hole_from;	/* The next hole after hole_from (--sparse) */
+	OFF_T hole_start, hole_end;
+	int find_holes;		/* Look for holes instead of reading them */
+	int direct;		/* The fd has O_DIRECT on (--direct-io) */
+	OFF_T dropped;		/* The page cache is dropped up to here */
 };
 
 #define MATCHFLG_WILD		(1<<0) /* pattern has '*', '[', and/or '?' */
@@ -838,6 +942,13 @@ struct stats {
 	int64 flist_size;
 	int num_files;
 	int num_transferred_files;
+	int adapted_block_files;
+	int64 read_wait_time;	/* microseconds spent waiting on file reads */
+	int64 file_write_calls;	/* the write system calls for file data */
+	int64 file_write_bytes;	/* ... and the bytes that they wrote */
+	int64 sock_read_calls;	/* the read system calls on the socket */
+	int64 sock_write_calls;	/* ... the writes */
+	int64 sock_wait_calls;	/* ... and the waits for it to be ready */
 };
 
 struct chmod_mode_struct;
@@ -893,6 +1004,7 @@ typedef struct {
 #include "lib/mdigest.h"
 #include "lib/wildmatch.h"
 #include "lib/permstring.h"
+#include "lib/zeros.h"
 #include "lib/addrinfo.h"
 
 #ifndef __GNUC__
@@ -31,6 +31,7 @@ extern int stdout_format_has_i;
 extern int logfile_format_has_i;
 extern int csum_length;
 extern int append_mode;
+extern int cdc_mode;
 extern int io_error;
 extern int allowed_lull;
 extern int preserve_xattrs;
@@ -69,6 +70,8 @@ static struct sum_struct *receive_sums(int f)
 	read_sum_head(f, s);
 
 	s->sums = NULL;
+	s->sum1_array = NULL;
+	s->sum2_array = NULL;
 
 	if (verbose > 3) {
 		rprintf(FINFO, "count=%.0f n=%ld rem=%ld\n",
@@ -85,20 +88,30 @@ static struct sum_struct *receive_sums(int f)
 	if (s->count == 0)
 		return(s);
 
-	if (!(s->sums = new_array(struct sum_buf, s->count)))
+	if (!(s->sums = new_array(struct sum_buf, s->count))
+	 || !(s->sum1_array = new_array(uint32, s->count))
+	 || !(s->sum2_array = new_array(char, (size_t)s->count * s->s2length)))
 		out_of_memory("receive_sums");
 
 	for (i = 0; i < s->count; i++) {
-		s->sums[i].sum1 = read_int(f);
-		read_buf(f, s->sums[i].sum2, s->s2length);
-
-		s->sums[i].offset = offset;
-		s->sums[i].flags = 0;
-
-		if (i == s->count-1 && s->remainder != 0)
+		if (cdc_mode) {
+			/* A --cdc chunk's length comes ahead of its sums. */
+			s->sums[i].len = read_varint(f);
+			if (s->sums[i].len <= 0 || s->sums[i].len > MAX_BLOCK_SIZE) {
+				rprintf(FERROR, "Invalid chunk length %ld [%s]\n",
+					(long)s->sums[i].len, who_am_i());
+				exit_cleanup(RERR_PROTOCOL);
+			}
+		} else if (i == s->count-1 && s->remainder != 0)
 			s->sums[i].len = s->remainder;
 		else
 			s->sums[i].len = s->blength;
+
+		s->sum1_array[i] = read_int(f);
+		read_buf(f, sum2_at(s, i), s->s2length);
+
+		s->sums[i].offset = offset;
+		s->sums[i].flags = 0;
 		offset += s->sums[i].len;
 
 		if (allowed_lull && !(i % lull_mod))
@@ -108,7 +121,7 @@ static struct sum_struct *receive_sums(int f)
 			rprintf(FINFO,
 				"chunk[%d] len=%d offset=%.0f sum1=%08x\n",
 				i, s->sums[i].len, (double)s->sums[i].offset,
-				s->sums[i].sum1);
+				s->sum1_array[i]);
 		}
 	}
 
@@ -0,0 +1,557 @@
+/*
+ * SSE2/SSSE3/SSE4.2/AVX2-optimized versions of the checksum routines (and
+ * of the zero scan that --sparse uses).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+/*
+ * Each rolling-checksum kernel consumes as many whole vector-sized chunks of the buffer as
+ * it can, folding them into s1 and s2 exactly as the scalar loop in
+ * get_checksum1() would have, and returns the number of bytes consumed so
+ * that the caller can finish off the tail.  For a run of n bytes b[1..n]
+ * the scalar loop computes:
+ *
+ *   s1 += sum(b[u] + CHAR_OFFSET)
+ *   s2 += n * s1_start + sum((n - u + 1) * (b[u] + CHAR_OFFSET))
+ *
+ * Each chunk contributes its plain byte-sum to a vector s1 and its
+ * position-weighted sum to a vector s2, while a third vector accumulates
+ * the running s1 total so that the chunk-sized weight of every earlier
+ * chunk can be applied once at the end.  All arithmetic is modulo 2^32,
+ * just like the scalar code, so the results are bit-identical.
+ */
+
+#include "rsync.h"
+
+#ifdef USE_SIMD_CHECKSUM
+
+#include <immintrin.h>
+
+typedef int32 (*csum1_kernel)(schar *buf, int32 len, uint32 *ps1, uint32 *ps2);
+
+static int32 checksum1_none(UNUSED(schar *buf), UNUSED(int32 len),
+			    UNUSED(uint32 *ps1), UNUSED(uint32 *ps2))
+{
+	return 0;
+}
+
+static inline uint32 hsum_epi32(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (uint32)_mm_cvtsi128_si32(v);
+}
+
+static inline void fold_sums(int32 n, int32 chunk, uint32 vs1, uint32 vs2,
+			     uint32 vps, uint32 *ps1, uint32 *ps2)
+{
+	*ps2 += (uint32)n * *ps1 + (uint32)chunk * vps + vs2;
+	*ps1 += vs1;
+#if CHAR_OFFSET != 0
+	*ps1 += (uint32)n * CHAR_OFFSET;
+	*ps2 += (uint32)((int64)n * (n + 1) / 2) * CHAR_OFFSET;
+#endif
+}
+
+/* SSE2 has no signed-byte multiply, so the bytes are sign-extended to
+ * 16 bits and fed through pmaddwd against the position weights. */
+static int32 checksum1_sse2(schar *buf, int32 len, uint32 *ps1, uint32 *ps2)
+{
+	const __m128i mul_lo = _mm_set_epi16(9, 10, 11, 12, 13, 14, 15, 16);
+	const __m128i mul_hi = _mm_set_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i vs1 = _mm_setzero_si128();
+	__m128i vs2 = _mm_setzero_si128();
+	__m128i vps = _mm_setzero_si128();
+	int32 i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+		__m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+
+		vps = _mm_add_epi32(vps, vs1);
+		vs1 = _mm_add_epi32(vs1, _mm_madd_epi16(_mm_add_epi16(lo, hi), ones));
+		vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(lo, mul_lo));
+		vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(hi, mul_hi));
+	}
+
+	if (i)
+		fold_sums(i, 16, hsum_epi32(vs1), hsum_epi32(vs2), hsum_epi32(vps), ps1, ps2);
+
+	return i;
+}
+
+/* SSSE3's pmaddubsw multiplies unsigned weights by signed bytes, which
+ * does the sign-extension and the first pairwise add in one step. */
+__attribute__ ((target("ssse3")))
+static int32 checksum1_ssse3(schar *buf, int32 len, uint32 *ps1, uint32 *ps2)
+{
+	const __m128i mul = _mm_set_epi8(1, 2, 3, 4, 5, 6, 7, 8,
+					 9, 10, 11, 12, 13, 14, 15, 16);
+	const __m128i ones8 = _mm_set1_epi8(1);
+	const __m128i ones16 = _mm_set1_epi16(1);
+	__m128i vs1 = _mm_setzero_si128();
+	__m128i vs2 = _mm_setzero_si128();
+	__m128i vps = _mm_setzero_si128();
+	int32 i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+
+		vps = _mm_add_epi32(vps, vs1);
+		vs1 = _mm_add_epi32(vs1, _mm_madd_epi16(_mm_maddubs_epi16(ones8, x), ones16));
+		vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_maddubs_epi16(mul, x), ones16));
+	}
+
+	if (i)
+		fold_sums(i, 16, hsum_epi32(vs1), hsum_epi32(vs2), hsum_epi32(vps), ps1, ps2);
+
+	return i;
+}
+
+__attribute__ ((target("avx2")))
+static inline uint32 hsum256_epi32(__m256i v)
+{
+	return hsum_epi32(_mm_add_epi32(_mm256_castsi256_si128(v),
+					_mm256_extracti128_si256(v, 1)));
+}
+
+__attribute__ ((target("avx2")))
+static int32 checksum1_avx2(schar *buf, int32 len, uint32 *ps1, uint32 *ps2)
+{
+	const __m256i mul = _mm256_set_epi8(1, 2, 3, 4, 5, 6, 7, 8,
+					    9, 10, 11, 12, 13, 14, 15, 16,
+					    17, 18, 19, 20, 21, 22, 23, 24,
+					    25, 26, 27, 28, 29, 30, 31, 32);
+	const __m256i ones8 = _mm256_set1_epi8(1);
+	const __m256i ones16 = _mm256_set1_epi16(1);
+	__m256i vs1 = _mm256_setzero_si256();
+	__m256i vs2 = _mm256_setzero_si256();
+	__m256i vps = _mm256_setzero_si256();
+	int32 i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(buf + i));
+
+		vps = _mm256_add_epi32(vps, vs1);
+		vs1 = _mm256_add_epi32(vs1, _mm256_madd_epi16(_mm256_maddubs_epi16(ones8, x), ones16));
+		vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(mul, x), ones16));
+	}
+
+	if (i)
+		fold_sums(i, 32, hsum256_epi32(vs1), hsum256_epi32(vs2), hsum256_epi32(vps), ps1, ps2);
+
+	return i;
+}
+
+static struct {
+	const char *name;
+	csum1_kernel fn;
+} csum1_kernels[] = {
+	{ "avx2", checksum1_avx2 },
+	{ "ssse3", checksum1_ssse3 },
+	{ "sse2", checksum1_sse2 },
+	{ "none", checksum1_none },
+	{ NULL, NULL }
+};
+
+static csum1_kernel csum1_fn;
+
+static int cpu_supports(const char *name)
+{
+	__builtin_cpu_init();
+	if (strcmp(name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if (strcmp(name, "ssse3") == 0)
+		return __builtin_cpu_supports("ssse3");
+	if (strcmp(name, "sse4.2") == 0)
+		return __builtin_cpu_supports("sse4.2");
+	return 1; /* SSE2 is part of the x86_64 baseline. */
+}
+
+/* Select the named rolling-checksum kernel (or the best one this CPU can
+ * run if name is NULL).  Returns 0 if the CPU can't run the named kernel. */
+int set_simd_checksum1(const char *name)
+{
+	int j;
+
+	for (j = 0; csum1_kernels[j].name; j++) {
+		if (name ? strcmp(name, csum1_kernels[j].name) != 0
+			 : !cpu_supports(csum1_kernels[j].name))
+			continue;
+		if (name && !cpu_supports(name))
+			return 0;
+		csum1_fn = csum1_kernels[j].fn;
+		return 1;
+	}
+
+	return 0;
+}
+
+int32 get_checksum1_simd(schar *buf, int32 len, uint32 *ps1, uint32 *ps2)
+{
+	if (!csum1_fn)
+		set_simd_checksum1(NULL);
+	return csum1_fn(buf, len, ps1, ps2);
+}
+
+/* The SSE4.2 crc32 instruction computes the same raw CRC32C as the table
+ * code in lib/crc32c.c, 8 bytes at a time. */
+__attribute__ ((target("sse4.2")))
+static int32 crc32c_sse42(uint32 *pcrc, const uchar *buf, int32 len)
+{
+	unsigned long long crc = *pcrc, v;
+	int32 i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&v, buf + i, 8);
+		crc = _mm_crc32_u64(crc, v);
+	}
+	for ( ; i < len; i++)
+		crc = _mm_crc32_u8((uint32)crc, buf[i]);
+
+	*pcrc = (uint32)crc;
+	return len;
+}
+
+static int crc32c_hw = -1;
+
+/* Continue the CRC over as much of buf as the CPU can handle, returning
+ * the number of bytes consumed (which is either 0 or len). */
+int32 get_crc32c_simd(uint32 *pcrc, const uchar *buf, int32 len)
+{
+	if (crc32c_hw < 0)
+		crc32c_hw = cpu_supports("sse4.2");
+	return crc32c_hw ? crc32c_sse42(pcrc, buf, len) : 0;
+}
+
+/* The zero-scan kernels return how many bytes at the start of buf are in
+ * whole chunks of zeros (64 or 128 bytes), leaving the rest of the scan to
+ * count_zeros() in lib/zeros.c. */
+typedef int32 (*zeros_kernel)(const char *buf, int32 len);
+
+static int32 zeros_none(UNUSED(const char *buf), UNUSED(int32 len))
+{
+	return 0;
+}
+
+static int32 zeros_sse2(const char *buf, int32 len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int32 i;
+
+	for (i = 0; i + 64 <= len; i += 64) {
+		__m128i x = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)(buf + i)),
+				     _mm_loadu_si128((const __m128i *)(buf + i + 16))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)(buf + i + 32)),
+				     _mm_loadu_si128((const __m128i *)(buf + i + 48))));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xFFFF)
+			break;
+	}
+
+	return i;
+}
+
+__attribute__ ((target("avx2")))
+static int32 zeros_avx2(const char *buf, int32 len)
+{
+	int32 i;
+
+	for (i = 0; i + 128 <= len; i += 128) {
+		__m256i x = _mm256_or_si256(
+			_mm256_or_si256(_mm256_loadu_si256((const __m256i *)(buf + i)),
+					_mm256_loadu_si256((const __m256i *)(buf + i + 32))),
+			_mm256_or_si256(_mm256_loadu_si256((const __m256i *)(buf + i + 64)),
+					_mm256_loadu_si256((const __m256i *)(buf + i + 96))));
+		if (!_mm256_testz_si256(x, x))
+			break;
+	}
+
+	return i;
+}
+
+static struct {
+	const char *name;
+	zeros_kernel fn;
+} zeros_kernels[] = {
+	{ "avx2", zeros_avx2 },
+	{ "sse2", zeros_sse2 },
+	{ "none", zeros_none },
+	{ NULL, NULL }
+};
+
+static zeros_kernel zeros_fn;
+
+/* Select the named zero-scan kernel, just like set_simd_checksum1(). */
+int set_simd_zeros(const char *name)
+{
+	int j;
+
+	for (j = 0; zeros_kernels[j].name; j++) {
+		if (name ? strcmp(name, zeros_kernels[j].name) != 0
+			 : !cpu_supports(zeros_kernels[j].name))
+			continue;
+		if (name && !cpu_supports(name))
+			return 0;
+		zeros_fn = zeros_kernels[j].fn;
+		return 1;
+	}
+
+	return 0;
+}
+
+int32 count_zeros_simd(const char *buf, int32 len)
+{
+	if (!zeros_fn)
+		set_simd_zeros(NULL);
+	return zeros_fn(buf, len);
+}
+
+/* The multi-buffer MD4/MD5 code below runs CSUM2_LANES independent hashes
+ * side by side, one per 32-bit lane of an SSE2 register.  Every lane must
+ * hash the same number of bytes, which is the normal case for the blocks
+ * of a file's signature. */
+
+#define VROTL(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+#define VADD3(x, y, z) _mm_add_epi32(x, _mm_add_epi32(y, z))
+#define VCONST(t) _mm_set1_epi32((int)(t))
+
+static inline void load_lanes(__m128i X[16], const uchar *p[CSUM2_LANES])
+{
+	int k;
+
+	for (k = 0; k < 16; k++) {
+		X[k] = _mm_set_epi32((int)IVALu(p[3], k*4), (int)IVALu(p[2], k*4),
+				     (int)IVALu(p[1], k*4), (int)IVALu(p[0], k*4));
+	}
+}
+
+static void md5_lanes_process(__m128i st[4], const uchar *p[CSUM2_LANES])
+{
+	const __m128i ones = _mm_set1_epi32(-1);
+	__m128i X[16], A, B, C, D;
+
+	load_lanes(X, p);
+
+	A = st[0];
+	B = st[1];
+	C = st[2];
+	D = st[3];
+
+#define P(a,b,c,d,k,s,t) a = VADD3(a, F(b,c,d), _mm_add_epi32(X[k], VCONST(t))), \
+			 a = _mm_add_epi32(VROTL(a, s), b)
+
+#define F(x,y,z) _mm_xor_si128(z, _mm_and_si128(x, _mm_xor_si128(y, z)))
+
+	P(A, B, C, D,  0,  7, 0xD76AA478);
+	P(D, A, B, C,  1, 12, 0xE8C7B756);
+	P(C, D, A, B,  2, 17, 0x242070DB);
+	P(B, C, D, A,  3, 22, 0xC1BDCEEE);
+	P(A, B, C, D,  4,  7, 0xF57C0FAF);
+	P(D, A, B, C,  5, 12, 0x4787C62A);
+	P(C, D, A, B,  6, 17, 0xA8304613);
+	P(B, C, D, A,  7, 22, 0xFD469501);
+	P(A, B, C, D,  8,  7, 0x698098D8);
+	P(D, A, B, C,  9, 12, 0x8B44F7AF);
+	P(C, D, A, B, 10, 17, 0xFFFF5BB1);
+	P(B, C, D, A, 11, 22, 0x895CD7BE);
+	P(A, B, C, D, 12,  7, 0x6B901122);
+	P(D, A, B, C, 13, 12, 0xFD987193);
+	P(C, D, A, B, 14, 17, 0xA679438E);
+	P(B, C, D, A, 15, 22, 0x49B40821);
+
+#undef F
+#define F(x,y,z) _mm_xor_si128(y, _mm_and_si128(z, _mm_xor_si128(x, y)))
+
+	P(A, B, C, D,  1,  5, 0xF61E2562);
+	P(D, A, B, C,  6,  9, 0xC040B340);
+	P(C, D, A, B, 11, 14, 0x265E5A51);
+	P(B, C, D, A,  0, 20, 0xE9B6C7AA);
+	P(A, B, C, D,  5,  5, 0xD62F105D);
+	P(D, A, B, C, 10,  9, 0x02441453);
+	P(C, D, A, B, 15, 14, 0xD8A1E681);
+	P(B, C, D, A,  4, 20, 0xE7D3FBC8);
+	P(A, B, C, D,  9,  5, 0x21E1CDE6);
+	P(D, A, B, C, 14,  9, 0xC33707D6);
+	P(C, D, A, B,  3, 14, 0xF4D50D87);
+	P(B, C, D, A,  8, 20, 0x455A14ED);
+	P(A, B, C, D, 13,  5, 0xA9E3E905);
+	P(D, A, B, C,  2,  9, 0xFCEFA3F8);
+	P(C, D, A, B,  7, 14, 0x676F02D9);
+	P(B, C, D, A, 12, 20, 0x8D2A4C8A);
+
+#undef F
+#define F(x,y,z) _mm_xor_si128(x, _mm_xor_si128(y, z))
+
+	P(A, B, C, D,  5,  4, 0xFFFA3942);
+	P(D, A, B, C,  8, 11, 0x8771F681);
+	P(C, D, A, B, 11, 16, 0x6D9D6122);
+	P(B, C, D, A, 14, 23, 0xFDE5380C);
+	P(A, B, C, D,  1,  4, 0xA4BEEA44);
+	P(D, A, B, C,  4, 11, 0x4BDECFA9);
+	P(C, D, A, B,  7, 16, 0xF6BB4B60);
+	P(B, C, D, A, 10, 23, 0xBEBFBC70);
+	P(A, B, C, D, 13,  4, 0x289B7EC6);
+	P(D, A, B, C,  0, 11, 0xEAA127FA);
+	P(C, D, A, B,  3, 16, 0xD4EF3085);
+	P(B, C, D, A,  6, 23, 0x04881D05);
+	P(A, B, C, D,  9,  4, 0xD9D4D039);
+	P(D, A, B, C, 12, 11, 0xE6DB99E5);
+	P(C, D, A, B, 15, 16, 0x1FA27CF8);
+	P(B, C, D, A,  2, 23, 0xC4AC5665);
+
+#undef F
+#define F(x,y,z) _mm_xor_si128(y, _mm_or_si128(x, _mm_xor_si128(z, ones)))
+
+	P(A, B, C, D,  0,  6, 0xF4292244);
+	P(D, A, B, C,  7, 10, 0x432AFF97);
+	P(C, D, A, B, 14, 15, 0xAB9423A7);
+	P(B, C, D, A,  5, 21, 0xFC93A039);
+	P(A, B, C, D, 12,  6, 0x655B59C3);
+	P(D, A, B, C,  3, 10, 0x8F0CCC92);
+	P(C, D, A, B, 10, 15, 0xFFEFF47D);
+	P(B, C, D, A,  1, 21, 0x85845DD1);
+	P(A, B, C, D,  8,  6, 0x6FA87E4F);
+	P(D, A, B, C, 15, 10, 0xFE2CE6E0);
+	P(C, D, A, B,  6, 15, 0xA3014314);
+	P(B, C, D, A, 13, 21, 0x4E0811A1);
+	P(A, B, C, D,  4,  6, 0xF7537E82);
+	P(D, A, B, C, 11, 10, 0xBD3AF235);
+	P(C, D, A, B,  2, 15, 0x2AD7D2BB);
+	P(B, C, D, A,  9, 21, 0xEB86D391);
+
+#undef F
+#undef P
+
+	st[0] = _mm_add_epi32(st[0], A);
+	st[1] = _mm_add_epi32(st[1], B);
+	st[2] = _mm_add_epi32(st[2], C);
+	st[3] = _mm_add_epi32(st[3], D);
+}
+
+static void md4_lanes_process(__m128i st[4], const uchar *p[CSUM2_LANES])
+{
+	__m128i X[16], A, B, C, D;
+
+	load_lanes(X, p);
+
+	A = st[0];
+	B = st[1];
+	C = st[2];
+	D = st[3];
+
+#define F(x,y,z) _mm_xor_si128(z, _mm_and_si128(x, _mm_xor_si128(y, z)))
+#define G(x,y,z) _mm_or_si128(_mm_and_si128(x, y), _mm_and_si128(z, _mm_or_si128(x, y)))
+#define H(x,y,z) _mm_xor_si128(x, _mm_xor_si128(y, z))
+
+#define ROUND1(a,b,c,d,k,s) a = VROTL(VADD3(a, F(b,c,d), X[k]), s)
+#define ROUND2(a,b,c,d,k,s) a = VROTL(VADD3(a, G(b,c,d), _mm_add_epi32(X[k], VCONST(0x5A827999))), s)
+#define ROUND3(a,b,c,d,k,s) a = VROTL(VADD3(a, H(b,c,d), _mm_add_epi32(X[k], VCONST(0x6ED9EBA1))), s)
+
+	ROUND1(A,B,C,D,  0,  3);  ROUND1(D,A,B,C,  1,  7);
+	ROUND1(C,D,A,B,  2, 11);  ROUND1(B,C,D,A,  3, 19);
+	ROUND1(A,B,C,D,  4,  3);  ROUND1(D,A,B,C,  5,  7);
+	ROUND1(C,D,A,B,  6, 11);  ROUND1(B,C,D,A,  7, 19);
+	ROUND1(A,B,C,D,  8,  3);  ROUND1(D,A,B,C,  9,  7);
+	ROUND1(C,D,A,B, 10, 11);  ROUND1(B,C,D,A, 11, 19);
+	ROUND1(A,B,C,D, 12,  3);  ROUND1(D,A,B,C, 13,  7);
+	ROUND1(C,D,A,B, 14, 11);  ROUND1(B,C,D,A, 15, 19);
+
+	ROUND2(A,B,C,D,  0,  3);  ROUND2(D,A,B,C,  4,  5);
+	ROUND2(C,D,A,B,  8,  9);  ROUND2(B,C,D,A, 12, 13);
+	ROUND2(A,B,C,D,  1,  3);  ROUND2(D,A,B,C,  5,  5);
+	ROUND2(C,D,A,B,  9,  9);  ROUND2(B,C,D,A, 13, 13);
+	ROUND2(A,B,C,D,  2,  3);  ROUND2(D,A,B,C,  6,  5);
+	ROUND2(C,D,A,B, 10,  9);  ROUND2(B,C,D,A, 14, 13);
+	ROUND2(A,B,C,D,  3,  3);  ROUND2(D,A,B,C,  7,  5);
+	ROUND2(C,D,A,B, 11,  9);  ROUND2(B,C,D,A, 15, 13);
+
+	ROUND3(A,B,C,D,  0,  3);  ROUND3(D,A,B,C,  8,  9);
+	ROUND3(C,D,A,B,  4, 11);  ROUND3(B,C,D,A, 12, 15);
+	ROUND3(A,B,C,D,  2,  3);  ROUND3(D,A,B,C, 10,  9);
+	ROUND3(C,D,A,B,  6, 11);  ROUND3(B,C,D,A, 14, 15);
+	ROUND3(A,B,C,D,  1,  3);  ROUND3(D,A,B,C,  9,  9);
+	ROUND3(C,D,A,B,  5, 11);  ROUND3(B,C,D,A, 13, 15);
+	ROUND3(A,B,C,D,  3,  3);  ROUND3(D,A,B,C, 11,  9);
+	ROUND3(C,D,A,B,  7, 11);  ROUND3(B,C,D,A, 15, 15);
+
+#undef F
+#undef G
+#undef H
+#undef ROUND1
+#undef ROUND2
+#undef ROUND3
+
+	st[0] = _mm_add_epi32(st[0], A);
+	st[1] = _mm_add_epi32(st[1], B);
+	st[2] = _mm_add_epi32(st[2], C);
+	st[3] = _mm_add_epi32(st[3], D);
+}
+
+/* Hash CSUM2_LANES buffers of len bytes each with MD5 (or with MD4 if
+ * use_md5 is 0), appending the seedlen bytes of seedbuf to every one of
+ * them.  The MD4 variant matches the protocol-27+ form of the hash. */
+void md_lanes_sse2(int use_md5, char **bufs, int32 len,
+		   const uchar *seedbuf, int seedlen, char **sums)
+{
+	void (*process)(__m128i *, const uchar **) = use_md5 ? md5_lanes_process : md4_lanes_process;
+	uchar tails[CSUM2_LANES][CSUM_CHUNK * 2];
+	const uchar *p[CSUM2_LANES];
+	uint32 lanes[4][CSUM2_LANES];
+	__m128i st[4];
+	int64 bits = ((int64)len + seedlen) * 8;
+	int32 off, rem = len % CSUM_CHUNK;
+	int j, k, tlen;
+
+	st[0] = VCONST(0x67452301);
+	st[1] = VCONST(0xEFCDAB89);
+	st[2] = VCONST(0x98BADCFE);
+	st[3] = VCONST(0x10325476);
+
+	for (off = 0; off + CSUM_CHUNK <= len; off += CSUM_CHUNK) {
+		for (j = 0; j < CSUM2_LANES; j++)
+			p[j] = (const uchar *)bufs[j] + off;
+		process(st, p);
+	}
+
+	tlen = rem + seedlen < CSUM_CHUNK - 8 ? CSUM_CHUNK : CSUM_CHUNK * 2;
+	for (j = 0; j < CSUM2_LANES; j++) {
+		uchar *t = tails[j];
+		memcpy(t, bufs[j] + off, rem);
+		if (seedlen)
+			memcpy(t + rem, seedbuf, seedlen);
+		t[rem + seedlen] = 0x80;
+		memset(t + rem + seedlen + 1, 0, tlen - (rem + seedlen + 1) - 8);
+		SIVALu(t, tlen - 8, (uint32)bits);
+		SIVALu(t, tlen - 4, (uint32)(bits >> 32));
+	}
+
+	for (off = 0; off < tlen; off += CSUM_CHUNK) {
+		for (j = 0; j < CSUM2_LANES; j++)
+			p[j] = tails[j] + off;
+		process(st, p);
+	}
+
+	for (k = 0; k < 4; k++)
+		_mm_storeu_si128((__m128i *)lanes[k], st[k]);
+	for (j = 0; j < CSUM2_LANES; j++) {
+		for (k = 0; k < 4; k++)
+			SIVALu((uchar *)sums[j], k*4, lanes[k][j]);
+	}
+}
+
+#endif /* USE_SIMD_CHECKSUM */
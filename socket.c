@@ -511,14 +511,11 @@ static RETSIGTYPE sigchld_handler(UNUSED(int val))
 }
 
 
-void start_accept_loop(int port, int (*fn)(int, int))
+/* Open the listening sockets, returning them in a -1-terminated array and
+ * setting deffds and maxfd for select(). */
+static int *open_listeners(int port, fd_set *deffds, int *maxfd)
 {
-	fd_set deffds;
-	int *sp, maxfd, i;
-
-#ifdef HAVE_SIGACTION
-	sigact.sa_flags = SA_NOCLDSTOP;
-#endif
+	int *sp, i;
 
 	/* open an incoming socket */
 	sp = open_socket_in(SOCK_STREAM, port, bind_address, default_af_hint);
@@ -526,8 +523,8 @@ void start_accept_loop(int port, int (*fn)(int, int))
 		exit_cleanup(RERR_SOCKETIO);
 
 	/* ready to listen */
-	FD_ZERO(&deffds);
-	for (i = 0, maxfd = -1; sp[i] >= 0; i++) {
+	FD_ZERO(deffds);
+	for (i = 0, *maxfd = -1; sp[i] >= 0; i++) {
 		if (listen(sp[i], 5) < 0) {
 			rsyserr(FERROR, errno, "listen() on socket failed");
 #ifdef INET6
@@ -538,68 +535,190 @@ void start_accept_loop(int port, int (*fn)(int, int))
 #endif
 			exit_cleanup(RERR_SOCKETIO);
 		}
-		FD_SET(sp[i], &deffds);
-		if (maxfd < sp[i])
-			maxfd = sp[i];
+		FD_SET(sp[i], deffds);
+		if (*maxfd < sp[i])
+			*maxfd = sp[i];
 	}
 
-	/* now accept incoming connections - forking a new process
-	 * for each incoming connection */
-	while (1) {
-		fd_set fds;
-		pid_t pid;
-		int fd;
-		struct sockaddr_storage addr;
-		socklen_t addrlen = sizeof addr;
-
-		/* close log file before the potentially very long select so
-		 * file can be trimmed by another process instead of growing
-		 * forever */
-		logfile_close();
+	return sp;
+}
+
+/* Wait (for up to secs seconds, or forever if secs is 0) for a connection
+ * on one of the listening sockets, and fork a child to run fn on it.
+ * Returns 1 if a child was started. */
+static int accept_connection(int *sp, fd_set *deffds, int maxfd, int secs,
+			     int (*fn)(int, int))
+{
+	fd_set fds;
+	struct timeval tv;
+	pid_t pid;
+	int fd, i;
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof addr;
+
+	/* close log file before the potentially very long select so
+	 * file can be trimmed by another process instead of growing
+	 * forever */
+	logfile_close();
 
 #ifdef FD_COPY
-		FD_COPY(&deffds, &fds);
+	FD_COPY(deffds, &fds);
 #else
-		fds = deffds;
+	fds = *deffds;
 #endif
 
-		if (select(maxfd + 1, &fds, NULL, NULL, NULL) < 1)
-			continue;
+	if (secs) {
+		tv.tv_sec = secs;
+		tv.tv_usec = 0;
+	}
 
-		for (i = 0, fd = -1; sp[i] >= 0; i++) {
-			if (FD_ISSET(sp[i], &fds)) {
-				fd = accept(sp[i], (struct sockaddr *)&addr,
-					    &addrlen);
+	if (select(maxfd + 1, &fds, NULL, NULL, secs ? &tv : NULL) < 1)
+		return 0;
+
+	for (i = 0, fd = -1; sp[i] >= 0; i++) {
+		if (FD_ISSET(sp[i], &fds)) {
+			fd = accept(sp[i], (struct sockaddr *)&addr,
+				    &addrlen);
+			break;
+		}
+	}
+
+	if (fd < 0)
+		return 0;
+
+	SIGACTION(SIGCHLD, sigchld_handler);
+
+	if ((pid = fork()) == 0) {
+		int ret;
+		for (i = 0; sp[i] >= 0; i++)
+			close(sp[i]);
+		/* Re-open log file in child before possibly giving
+		 * up privileges (see logfile_close() above). */
+		logfile_reopen();
+		ret = fn(fd, fd);
+		close_all();
+		_exit(ret);
+	} else if (pid < 0) {
+		rsyserr(FERROR, errno,
+			"could not create child server process");
+		close(fd);
+		/* This might have happened because we're
+		 * overloaded.  Sleep briefly before trying to
+		 * accept again. */
+		sleep(2);
+		return 0;
+	}
+
+	/* Parent doesn't need this fd anymore. */
+	close(fd);
+	return 1;
+}
+
+void start_accept_loop(int port, int (*fn)(int, int))
+{
+	fd_set deffds;
+	int *sp, maxfd;
+
+#ifdef HAVE_SIGACTION
+	sigact.sa_flags = SA_NOCLDSTOP;
+#endif
+
+	sp = open_listeners(port, &deffds, &maxfd);
+
+	/* now accept incoming connections - forking a new process
+	 * for each incoming connection.  We wake up in time to update
+	 * the "bwlimit status file". */
+	while (1)
+		accept_connection(sp, &deffds, maxfd, bwlimit_shared_status(), fn);
+}
+
+static RETSIGTYPE pool_sigchld_handler(UNUSED(int val))
+{
+	/* This just interrupts the pool's select(); it does the reaping. */
+#ifndef HAVE_SIGACTION
+	signal(SIGCHLD, pool_sigchld_handler);
+#endif
+}
+
+/* A pool worker accepts connections on the listening sockets that it
+ * shares with the other workers, and forks a child for each one (which
+ * saves it redoing whatever worker_ok() has already set up).  It exits
+ * after the given number of sessions (if not 0), when worker_ok() says
+ * that it's out of date, or when the daemon goes away. */
+static void run_worker(int *sp, fd_set *deffds, int maxfd, int sessions,
+		       int (*fn)(int, int), int (*worker_ok)(void))
+{
+	pid_t daemon_pid = getppid();
+	int i, done = 0;
+
+	/* The workers race to accept each connection, so the losers need
+	 * to get EAGAIN instead of blocking. */
+	for (i = 0; sp[i] >= 0; i++)
+		set_nonblocking(sp[i]);
+
+	while (getppid() == daemon_pid && worker_ok()) {
+		if (accept_connection(sp, deffds, maxfd, 1, fn)
+		 && sessions && ++done == sessions)
+			break;
+	}
+}
+
+/* Like start_accept_loop(), but the connections are accepted by a pool of
+ * pre-forked worker processes, which the daemon replaces as they exit. */
+void start_worker_pool(int port, int workers, int sessions,
+		       int (*fn)(int, int), int (*worker_ok)(void))
+{
+	fd_set deffds;
+	struct timeval tv;
+	int *sp, maxfd, secs, j;
+	pid_t pid, *worker_pids;
+
+#ifdef HAVE_SIGACTION
+	sigact.sa_flags = SA_NOCLDSTOP;
+#endif
+
+	if (!(worker_pids = new_array0(pid_t, workers)))
+		out_of_memory("start_worker_pool");
+
+	sp = open_listeners(port, &deffds, &maxfd);
+
+	SIGACTION(SIGCHLD, pool_sigchld_handler);
+
+	while (1) {
+		for (j = 0; j < workers; j++) {
+			if (worker_pids[j])
+				continue;
+			if ((pid = fork()) == 0) {
+				run_worker(sp, &deffds, maxfd, sessions,
+					   fn, worker_ok);
+				close_all();
+				_exit(0);
+			}
+			if (pid < 0) {
+				rsyserr(FERROR, errno,
+					"could not create worker process");
 				break;
 			}
+			worker_pids[j] = pid;
 		}
 
-		if (fd < 0)
-			continue;
-
-		SIGACTION(SIGCHLD, sigchld_handler);
-
-		if ((pid = fork()) == 0) {
-			int ret;
-			for (i = 0; sp[i] >= 0; i++)
-				close(sp[i]);
-			/* Re-open log file in child before possibly giving
-			 * up privileges (see logfile_close() above). */
-			logfile_reopen();
-			ret = fn(fd, fd);
-			close_all();
-			_exit(ret);
-		} else if (pid < 0) {
-			rsyserr(FERROR, errno,
-				"could not create child server process");
-			close(fd);
-			/* This might have happened because we're
-			 * overloaded.  Sleep briefly before trying to
-			 * accept again. */
-			sleep(2);
-		} else {
-			/* Parent doesn't need this fd anymore. */
-			close(fd);
+		/* A SIGCHLD interrupts the wait.  The timeout catches one
+		 * that came in before we started waiting (or a fork that
+		 * failed) and keeps the "bwlimit status file" current. */
+		logfile_close();
+		if (!(secs = bwlimit_shared_status()) || secs > 2)
+			secs = 2;
+		tv.tv_sec = secs;
+		tv.tv_usec = 0;
+		select(0, NULL, NULL, NULL, &tv);
+
+		/* A worker's sessions outlive it, so (if we're init) we can
+		 * also be reaping those. */
+		while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+			for (j = 0; j < workers; j++) {
+				if (worker_pids[j] == pid)
+					worker_pids[j] = 0;
+			}
 		}
 	}
 }
@@ -0,0 +1,454 @@
+/*
+ * The --checksum-cache files, which remember the whole-file checksums of
+ * the files in a directory.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+/*
+ * With --checksum-cache, each directory that rsync computes --checksum sums
+ * in (or writes files into) gets a SUMCACHE_NAME file that records each
+ * file's checksum along with the dev, inode, size, mtime, and ctime that it
+ * had when the sum was made.  A later run uses the recorded sum instead of
+ * reading the file if none of those have changed (any write to a file, or
+ * a change of its attributes, gives it a new ctime).  The sender and the
+ * generator record the sums that file_checksum() computes, and the receiver
+ * records the sum that it computed while it was writing each new file, so
+ * a second --checksum run over an unchanged tree reads no file data.
+ *
+ * The file is a list of binary records, each of which replaces any earlier
+ * record for the same name.  New records are appended with a single write()
+ * (so the processes that share a directory can't mix up their records), and
+ * a file that has collected too many replaced records (or that has a broken
+ * one) gets rewritten without them when it is next read.  The cache is only
+ * a hint: a missing, unreadable, or unwritable file just means that the
+ * sums get computed from the data.
+ */
+
+#include "rsync.h"
+
+extern int dry_run;
+
+extern char curr_dir[MAXPATHLEN];
+
+/* The layout of a record, which is followed by the sum and the name. */
+#define REC_LEN 0	/* int32: the length of the whole record */
+#define REC_TYPE 4	/* byte: the CSUM_* type of the sum */
+#define REC_SUM_LEN 5	/* byte */
+#define REC_NAME_LEN 6	/* 2 bytes */
+#define REC_DEV 8	/* int64 */
+#define REC_INO 16	/* int64 */
+#define REC_SIZE 24	/* int64 */
+#define REC_MTIME 32	/* int64 */
+#define REC_CTIME 40	/* int64 */
+#define REC_MTIME_NSEC 48 /* int32 */
+#define REC_CTIME_NSEC 52 /* int32 */
+#define REC_HDR_LEN 56
+
+#define MAX_REC_LEN (REC_HDR_LEN + MAX_DIGEST_LEN + MAXPATHLEN)
+
+struct sum_entry {
+	struct sum_entry *next;	/* another name with the same hash */
+	char *name;
+	int64 dev, ino, size, mtime, ctime;
+	int32 mtime_nsec, ctime_nsec;
+	uchar type, len;
+	char sum[MAX_DIGEST_LEN];
+};
+
+static struct {
+	char dir[MAXPATHLEN];	/* the dir whose cache is loaded ("" if none) */
+	struct hashtable *tbl;	/* the entries by the hash of their names */
+	struct sum_entry **entries;
+	int cnt, alloc;
+	int fd;			/* for appending, or -1 (-2 if that failed) */
+} cache = { "", NULL, NULL, 0, 0, -1 };
+
+static void put64(char *buf, int pos, int64 val)
+{
+	SIVAL(buf, pos, (uint32)val);
+	SIVAL(buf, pos + 4, (uint32)((uint64)val >> 32));
+}
+
+static int64 get64(const char *buf, int pos)
+{
+	return (int64)((uint64)IVAL(buf, pos) | (uint64)IVAL(buf, pos + 4) << 32);
+}
+
+/* A 64-bit FNV-1a hash of the name (which is never 0, since the hashtable
+ * doesn't allow that key). */
+static int64 name_hash(const char *name)
+{
+	uint64 h = 0xcbf29ce484222325ULL;
+
+	while (*name)
+		h = (h ^ (uchar)*name++) * 0x100000001b3ULL;
+
+	return h ? (int64)h : 1;
+}
+
+/* Return the entry for name, or NULL if there isn't one (and add isn't
+ * set) -- if add is set, an empty one is added. */
+static struct sum_entry *find_entry(const char *name, int add)
+{
+	struct ht_int64_node *node;
+	struct sum_entry *ep;
+
+	if (!cache.tbl) {
+		if (!add)
+			return NULL;
+		cache.tbl = hashtable_create(1024, 1);
+	}
+	if (!(node = hashtable_find(cache.tbl, name_hash(name), add)))
+		return NULL;
+
+	for (ep = node->data; ep; ep = ep->next) {
+		if (strcmp(ep->name, name) == 0)
+			return ep;
+	}
+	if (!add)
+		return NULL;
+
+	if (cache.cnt == cache.alloc) {
+		cache.alloc = cache.alloc ? cache.alloc * 2 : 256;
+		cache.entries = realloc_array(cache.entries, struct sum_entry *,
+					      cache.alloc);
+		if (!cache.entries)
+			out_of_memory("find_entry");
+	}
+	if (!(ep = new0(struct sum_entry)) || !(ep->name = strdup(name)))
+		out_of_memory("find_entry");
+	ep->next = node->data;
+	node->data = ep;
+	cache.entries[cache.cnt++] = ep;
+
+	return ep;
+}
+
+static void set_entry(struct sum_entry *ep, STRUCT_STAT *st, int type,
+		      int len, const char *sum)
+{
+	ep->dev = st->st_dev;
+	ep->ino = st->st_ino;
+	ep->size = st->st_size;
+	ep->mtime = st->st_mtime;
+	ep->ctime = st->st_ctime;
+	ep->mtime_nsec = ST_MTIME_NSEC(st);
+	ep->ctime_nsec = ST_CTIME_NSEC(st);
+	ep->type = type;
+	ep->len = len;
+	memcpy(ep->sum, sum, len);
+}
+
+/* Fill buf with the record for ep, returning its length. */
+static int make_record(char *buf, struct sum_entry *ep)
+{
+	int name_len = strlen(ep->name);
+	int rec_len = REC_HDR_LEN + ep->len + name_len;
+
+	SIVAL(buf, REC_LEN, rec_len);
+	CVAL(buf, REC_TYPE) = ep->type;
+	CVAL(buf, REC_SUM_LEN) = ep->len;
+	SSVALX(buf, REC_NAME_LEN, name_len);
+	put64(buf, REC_DEV, ep->dev);
+	put64(buf, REC_INO, ep->ino);
+	put64(buf, REC_SIZE, ep->size);
+	put64(buf, REC_MTIME, ep->mtime);
+	put64(buf, REC_CTIME, ep->ctime);
+	SIVAL(buf, REC_MTIME_NSEC, ep->mtime_nsec);
+	SIVAL(buf, REC_CTIME_NSEC, ep->ctime_nsec);
+	memcpy(buf + REC_HDR_LEN, ep->sum, ep->len);
+	memcpy(buf + REC_HDR_LEN + ep->len, ep->name, name_len);
+
+	return rec_len;
+}
+
+/* Parse the records in the cache file's data.  Returns the number of
+ * records, or -1 if there is a broken one (the ones before it are kept). */
+static int parse_records(const char *data, size_t size)
+{
+	size_t pos;
+	int records = 0;
+
+	for (pos = 0; pos < size; records++) {
+		const char *rec = data + pos;
+		char name[MAXPATHLEN];
+		struct sum_entry *ep;
+		int rec_len, sum_len, name_len;
+
+		if (size - pos < REC_HDR_LEN)
+			return -1;
+		rec_len = IVAL(rec, REC_LEN);
+		sum_len = CVAL(rec, REC_SUM_LEN);
+		name_len = PVAL(rec, REC_NAME_LEN);
+		if (rec_len != REC_HDR_LEN + sum_len + name_len
+		 || (size_t)rec_len > size - pos || sum_len > MAX_DIGEST_LEN
+		 || !name_len || name_len >= MAXPATHLEN)
+			return -1;
+
+		memcpy(name, rec + REC_HDR_LEN + sum_len, name_len);
+		name[name_len] = '\0';
+		if (strlen(name) != (size_t)name_len || strchr(name, '/'))
+			return -1;
+
+		ep = find_entry(name, 1);
+		ep->type = CVAL(rec, REC_TYPE);
+		ep->len = sum_len;
+		ep->dev = get64(rec, REC_DEV);
+		ep->ino = get64(rec, REC_INO);
+		ep->size = get64(rec, REC_SIZE);
+		ep->mtime = get64(rec, REC_MTIME);
+		ep->ctime = get64(rec, REC_CTIME);
+		ep->mtime_nsec = IVAL(rec, REC_MTIME_NSEC);
+		ep->ctime_nsec = IVAL(rec, REC_CTIME_NSEC);
+		memcpy(ep->sum, rec + REC_HDR_LEN, sum_len);
+
+		pos += rec_len;
+	}
+
+	return records;
+}
+
+/* Returns 1 if the loaded dir's mtime and ctime are still those in st. */
+static int dir_times_same(STRUCT_STAT *st)
+{
+	STRUCT_STAT now;
+
+	return do_stat(cache.dir, &now) == 0
+	    && now.st_mtime == st->st_mtime
+	    && ST_MTIME_NSEC(&now) == ST_MTIME_NSEC(st)
+	    && now.st_ctime == st->st_ctime
+	    && ST_CTIME_NSEC(&now) == ST_CTIME_NSEC(st);
+}
+
+/* Write the cache file for the loaded dir afresh, with just one record for
+ * each name (of a file that still exists).  It is renamed into place, so a
+ * reader never sees half of it. */
+static void rewrite_cache(const char *fname)
+{
+	char tmpname[MAXPATHLEN], *data;
+	size_t size = 0, done;
+	STRUCT_STAT st, dir_st, tmp_dir_st;
+	int fd, j, ok;
+
+	if (dry_run)
+		return;
+	if (pathjoin(tmpname, sizeof tmpname, cache.dir, SUMCACHE_NAME ".XXXXXX")
+	    >= sizeof tmpname)
+		return;
+
+	for (j = 0; j < cache.cnt; j++)
+		size += REC_HDR_LEN + cache.entries[j]->len + strlen(cache.entries[j]->name);
+	if (!(data = new_array(char, size + 1)))
+		out_of_memory("rewrite_cache");
+	for (j = 0, size = 0; j < cache.cnt; j++) {
+		struct sum_entry *ep = cache.entries[j];
+		if (pathjoin(tmpname, sizeof tmpname, cache.dir, ep->name) < sizeof tmpname
+		 && do_lstat(tmpname, &st) < 0 && errno == ENOENT)
+			continue;
+		size += make_record(data + size, ep);
+	}
+
+	pathjoin(tmpname, sizeof tmpname, cache.dir, SUMCACHE_NAME ".XXXXXX");
+
+	/* The dir's mtime is put back afterwards, since rsync would
+	 * otherwise see it as changed -- but not if something else
+	 * changed the dir while we were writing the file. */
+	if (do_stat(cache.dir, &dir_st) < 0)
+		dir_st.st_mtime = 0;
+	if ((fd = do_mkstemp(tmpname, 0644)) < 0) {
+		free(data);
+		return;
+	}
+	if (do_stat(cache.dir, &tmp_dir_st) < 0)
+		dir_st.st_mtime = 0;
+	for (done = 0, ok = 1; done < size && ok; ) {
+		ssize_t n = write(fd, data + done, size - done);
+		if (n > 0)
+			done += n;
+		else if (n == 0 || errno != EINTR)
+			ok = 0;
+	}
+	if (close(fd) < 0)
+		ok = 0;
+	free(data);
+
+	if (dir_st.st_mtime && !dir_times_same(&tmp_dir_st))
+		dir_st.st_mtime = 0;
+	if (!ok || do_rename(tmpname, fname) < 0)
+		do_unlink(tmpname);
+	else if (dir_st.st_mtime)
+		set_modtime(cache.dir, dir_st.st_mtime, dir_st.st_mode);
+}
+
+static void unload_cache(void)
+{
+	int j;
+
+	if (cache.fd >= 0)
+		close(cache.fd);
+	cache.fd = -1;
+
+	for (j = 0; j < cache.cnt; j++) {
+		free(cache.entries[j]->name);
+		free(cache.entries[j]);
+	}
+	cache.cnt = 0;
+	if (cache.tbl) {
+		hashtable_destroy(cache.tbl);
+		cache.tbl = NULL;
+	}
+	cache.dir[0] = '\0';
+}
+
+/* Make the cache of the dir that holds fname the loaded one, and return
+ * the basename of fname (or NULL if it can't be cached). */
+static const char *load_cache(const char *fname)
+{
+	char dir[MAXPATHLEN], cache_fname[MAXPATHLEN];
+	const char *base = strrchr(fname, '/');
+	STRUCT_STAT st;
+	char *data;
+	int fd, records;
+
+	if (*fname == '/')
+		strlcpy(dir, fname, sizeof dir);
+	else if (pathjoin(dir, sizeof dir, curr_dir, fname) >= sizeof dir)
+		return NULL;
+	/* Chop off the basename, leaving the dir's full path. */
+	*strrchr(dir, '/') = '\0';
+	base = base ? base + 1 : fname;
+	if (!*base || strcmp(base, SUMCACHE_NAME) == 0)
+		return NULL;
+
+	if (strcmp(dir, cache.dir) == 0)
+		return base;
+
+	unload_cache();
+	strlcpy(cache.dir, dir, sizeof cache.dir);
+
+	if (pathjoin(cache_fname, sizeof cache_fname, dir, SUMCACHE_NAME)
+	    >= sizeof cache_fname)
+		return NULL;
+	if ((fd = do_open(cache_fname, O_RDONLY, 0)) < 0)
+		return base;
+	if (do_fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0
+	 || st.st_size > (OFF_T)1 << 30) {
+		close(fd);
+		return base;
+	}
+
+	if (!(data = new_array(char, st.st_size)))
+		out_of_memory("load_cache");
+	if (read(fd, data, st.st_size) == (ssize_t)st.st_size) {
+		records = parse_records(data, st.st_size);
+		if (records < 0 || records > 2 * cache.cnt + 16)
+			rewrite_cache(cache_fname);
+	}
+	free(data);
+	close(fd);
+
+	return base;
+}
+
+/* Look up the cached checksum of fname, whose stat info is in st.  Returns
+ * 1 and fills in sum if there is one of the current type that is still
+ * good, or 0 if the file has to be read. */
+int sumcache_lookup(const char *fname, STRUCT_STAT *st, char *sum)
+{
+	struct sum_entry *ep;
+	const char *base;
+
+	if (checksum_type() == CSUM_MD4 || !(base = load_cache(fname))
+	 || !(ep = find_entry(base, 0)))
+		return 0;
+
+	if (ep->type != checksum_type() || ep->len != checksum_digest_len()
+	 || ep->dev != (int64)st->st_dev || ep->ino != (int64)st->st_ino
+	 || ep->size != (int64)st->st_size
+	 || ep->mtime != (int64)st->st_mtime || ep->ctime != (int64)st->st_ctime
+	 || ep->mtime_nsec != (int32)ST_MTIME_NSEC(st)
+	 || ep->ctime_nsec != (int32)ST_CTIME_NSEC(st))
+		return 0;
+
+	memset(sum, 0, MAX_DIGEST_LEN);
+	memcpy(sum, ep->sum, ep->len);
+
+	return 1;
+}
+
+/* Remember the checksum of fname, whose stat info is in st (or which gets
+ * stat'ed here if st is NULL). */
+void sumcache_store(const char *fname, STRUCT_STAT *st, const char *sum)
+{
+	char buf[MAX_REC_LEN];
+	STRUCT_STAT st2;
+	struct sum_entry *ep;
+	const char *base;
+	int len;
+
+	/* The MD4 sums are seeded, so they aren't the same from run to run. */
+	if (dry_run || checksum_type() == CSUM_MD4 || !(base = load_cache(fname)))
+		return;
+	if (!st) {
+		if (do_stat(fname, &st2) < 0 || !S_ISREG(st2.st_mode))
+			return;
+		st = &st2;
+	}
+
+	/* Without subsecond times, a file that changed within a second of
+	 * now could change again without its times changing. */
+	if (!ST_CTIME_NSEC(st) && st->st_ctime >= time(NULL) - 1)
+		return;
+
+	ep = find_entry(base, 1);
+	set_entry(ep, st, checksum_type(), checksum_digest_len(), sum);
+
+	if (cache.fd == -1) {
+		char cache_fname[MAXPATHLEN];
+		pathjoin(cache_fname, sizeof cache_fname, cache.dir, SUMCACHE_NAME);
+		cache.fd = do_open(cache_fname, O_WRONLY | O_APPEND, 0);
+		if (cache.fd < 0 && errno == ENOENT) {
+			/* Creating the file changes the dir's mtime, which
+			 * we put back so that rsync doesn't see it. */
+			STRUCT_STAT dir_st;
+			if (do_stat(cache.dir, &dir_st) < 0)
+				dir_st.st_mtime = 0;
+			cache.fd = do_open(cache_fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+			if (cache.fd >= 0 && dir_st.st_mtime)
+				set_modtime(cache.dir, dir_st.st_mtime, dir_st.st_mode);
+		}
+		if (cache.fd < 0)
+			cache.fd = -2;
+	}
+	if (cache.fd < 0)
+		return;
+
+	len = make_record(buf, ep);
+	if (write(cache.fd, buf, len) != len) {
+		close(cache.fd);
+		cache.fd = -2;
+	}
+}
+
+/* Find the whole-file checksum of fname for --checksum, using the cache
+ * when that's possible (and remembering a newly computed sum). */
+void cached_file_checksum(char *fname, STRUCT_STAT *st, char *sum)
+{
+	if (sumcache_lookup(fname, st, sum))
+		return;
+
+	if (file_checksum(fname, sum, st->st_size))
+		sumcache_store(fname, st, sum);
+}
@@ -271,6 +271,38 @@ int do_fstat(int fd, STRUCT_STAT *st)
 #endif
 }
 
+#ifdef SUPPORT_PREALLOCATION
+/* Allocate the disk space for length bytes at offset in fd.  With
+ * keep_size, the file's size is left alone (which fails where the
+ * system can't do that); otherwise the file is extended if it is
+ * shorter than offset + length. */
+int do_fallocate(int fd, OFF_T offset, OFF_T length, int keep_size)
+{
+	RETURN_ERROR_IF(dry_run, 0);
+	RETURN_ERROR_IF_RO_OR_LO;
+	if (keep_size) {
+#if defined HAVE_FALLOCATE && defined FALLOC_FL_KEEP_SIZE
+		return fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, length);
+#else
+		errno = EOPNOTSUPP;
+		return -1;
+#endif
+	}
+#ifdef HAVE_FALLOCATE
+	return fallocate(fd, 0, offset, length);
+#else
+	{
+		int err = posix_fallocate(fd, offset, length);
+		if (err) {
+			errno = err;
+			return -1;
+		}
+		return 0;
+	}
+#endif
+}
+#endif
+
 OFF_T do_lseek(int fd, OFF_T offset, int whence)
 {
 #ifdef HAVE_LSEEK64
@@ -85,6 +85,10 @@ struct filter_list_struct daemon_filter_list;
 	return 0;
 }
 
+ void evloop_reset(void)
+{
+}
+
  const char *who_am_i(void)
 {
 	return "tester";
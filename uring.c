@@ -0,0 +1,265 @@
+/*
+ * An io_uring write-behind engine for the receiver's file writes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+/*
+ * With --io-uring, write_file() hands each full write buffer to the kernel
+ * through an io_uring and carries on filling another buffer, so the disk
+ * writes overlap the receiver's reading of the next data from the socket.
+ * flush_write_file() waits for all the writes to finish (and puts the
+ * file offset where a write() would have left it), so the rest of the
+ * receiver sees the same file that the plain write() code leaves.
+ *
+ * The ring is set up with raw system calls (there's no need for liburing),
+ * and if the kernel won't give us one, the caller just sticks to write().
+ */
+
+#include "rsync.h"
+
+#ifdef SUPPORT_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+/* These numbers are the same on (nearly) every architecture. */
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+#define URING_BUFS 8
+
+static struct {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+} ring = { -1, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+
+static struct {
+	char *buf;
+	struct iovec iov;
+	OFF_T offset;
+	int busy;
+} bufs[URING_BUFS];
+
+static size_t buf_size;
+static int busy_cnt;
+static int write_fd = -1;	/* the fd of the writes in flight (or -1) */
+static OFF_T write_offset;	/* where the next write goes */
+static int write_errno;		/* the first error from a write */
+
+static int setup_ring(void)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof p);
+	if ((ring.fd = syscall(__NR_io_uring_setup, URING_BUFS, &p)) < 0)
+		return 0;
+
+	sq = mmap(NULL, p.sq_off.array + p.sq_entries * sizeof (unsigned),
+		  PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, IORING_OFF_SQ_RING);
+	cq = mmap(NULL, p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe),
+		  PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, IORING_OFF_CQ_RING);
+	ring.sqes = mmap(NULL, p.sq_entries * sizeof (struct io_uring_sqe),
+			 PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || ring.sqes == MAP_FAILED) {
+		close(ring.fd);
+		ring.fd = -1;
+		return 0;
+	}
+
+	ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 1;
+}
+
+/* Set up the ring and its write buffers of the given size.  Returns 0 if
+ * the kernel doesn't support io_uring (or won't let us use it). */
+int uring_init(size_t size)
+{
+	static int tried = 0;
+	int j;
+
+	if (tried)
+		return ring.fd >= 0;
+	tried = 1;
+
+	if (!setup_ring()) {
+		if (verbose > 1) {
+			rsyserr(FINFO, errno,
+				"io_uring is not available, using write()");
+		}
+		return 0;
+	}
+
+	buf_size = size;
+	for (j = 0; j < URING_BUFS; j++) {
+		if (!(bufs[j].buf = new_array(char, buf_size)))
+			out_of_memory("uring_init");
+	}
+
+	return 1;
+}
+
+/* Handle the write that a completion is for.  A short write gets finished
+ * off with pwrite() (which should be rare). */
+static void complete_write(struct io_uring_cqe *cqe)
+{
+	int j = (int)cqe->user_data;
+	size_t done = cqe->res > 0 ? (size_t)cqe->res : 0;
+
+	if (cqe->res < 0) {
+		if (!write_errno)
+			write_errno = -cqe->res;
+	} else {
+		while (done < bufs[j].iov.iov_len && !write_errno) {
+			ssize_t n = pwrite(write_fd, bufs[j].buf + done,
+					   bufs[j].iov.iov_len - done,
+					   bufs[j].offset + done);
+			if (n > 0)
+				done += n;
+			else if (n == 0)
+				write_errno = ENOSPC;
+			else if (errno != EINTR)
+				write_errno = errno;
+		}
+	}
+
+	bufs[j].busy = 0;
+	busy_cnt--;
+}
+
+/* Reap the finished writes, waiting until at least min_cnt of them are
+ * done. */
+static void reap_writes(int min_cnt)
+{
+	unsigned head;
+
+	while (1) {
+		head = *ring.cq_head;
+		while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			complete_write(&ring.cqes[head & *ring.cq_mask]);
+			head++;
+			min_cnt--;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+		if (min_cnt <= 0 || !busy_cnt)
+			break;
+		if (syscall(__NR_io_uring_enter, ring.fd, 0, 1,
+			    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+			rsyserr(FERROR, errno, "io_uring_enter failed");
+			exit_cleanup(RERR_FILEIO);
+		}
+	}
+}
+
+/* Return a write buffer that isn't in use (waiting for one, if need be). */
+char *uring_buffer(void)
+{
+	int j;
+
+	if (busy_cnt == URING_BUFS)
+		reap_writes(1);
+
+	for (j = 0; bufs[j].busy; j++) {}
+
+	return bufs[j].buf;
+}
+
+/* Queue a write of len bytes from buf (one of our buffers) to the end of
+ * what we've written to fd so far.  Returns a free buffer for the caller
+ * to fill next, or NULL (with errno set) if an earlier write failed. */
+char *uring_write(int fd, char *buf, size_t len)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail;
+	int j;
+
+	if (fd != write_fd) {
+		if (write_fd >= 0 && uring_wait(write_fd) < 0)
+			return NULL;
+		write_fd = fd;
+		if ((write_offset = do_lseek(fd, 0, SEEK_CUR)) < 0)
+			return NULL;
+	}
+
+	if (write_errno) {
+		errno = write_errno;
+		return NULL;
+	}
+
+	for (j = 0; bufs[j].buf != buf; j++) {}
+	bufs[j].iov.iov_base = buf;
+	bufs[j].iov.iov_len = len;
+	bufs[j].offset = write_offset;
+	bufs[j].busy = 1;
+	busy_cnt++;
+	write_offset += len;
+
+	tail = *ring.sq_tail;
+	sqe = &ring.sqes[tail & *ring.sq_mask];
+	memset(sqe, 0, sizeof sqe[0]);
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = fd;
+	sqe->off = bufs[j].offset;
+	sqe->addr = (unsigned long)&bufs[j].iov;
+	sqe->len = 1;
+	sqe->user_data = j;
+	ring.sq_array[tail & *ring.sq_mask] = tail & *ring.sq_mask;
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	while (syscall(__NR_io_uring_enter, ring.fd, 1, 0, 0, NULL, 0) < 0) {
+		if (errno != EINTR) {
+			rsyserr(FERROR, errno, "io_uring_enter failed");
+			exit_cleanup(RERR_FILEIO);
+		}
+	}
+
+	return uring_buffer();
+}
+
+/* Wait for all the writes to fd to finish, and leave its file offset just
+ * past the data.  Returns -1 (with errno set) if any write failed. */
+int uring_wait(int fd)
+{
+	if (fd != write_fd)
+		return 0;
+
+	reap_writes(busy_cnt);
+	write_fd = -1;
+
+	if (write_errno) {
+		errno = write_errno;
+		write_errno = 0;
+		return -1;
+	}
+
+	return do_lseek(fd, write_offset, SEEK_SET) == write_offset ? 0 : -1;
+}
+
+#endif
@@ -22,6 +22,12 @@
 
 #include "rsync.h"
 #include "ifuncs.h"
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+
+#define CLONE_ALIGN 4096 /* the block size that FICLONERANGE needs */
+#define COPY_RANGE_MAX ((OFF_T)1 << 30) /* the most per copy_file_range() */
 
 extern int verbose;
 extern int dry_run;
@@ -263,6 +269,65 @@ static int safe_read(int desc, char *ptr, size_t len)
 	return n_chars;
 }
 
+/* Copy len bytes from offset in fd_in to f at its file offset (so a caller
+ * that buffers writes must flush them first), leaving the offset just past
+ * the data.  The kernel does the copying, and a filesystem that can share
+ * data blocks (e.g. btrfs or XFS) just points f at fd_in's blocks.  Returns
+ * how many bytes got copied, which is short (often 0) if the kernel won't
+ * copy the data, in which case the caller must write the rest itself. */
+OFF_T copy_range(int fd_in, OFF_T offset, int f, OFF_T len)
+{
+	OFF_T done = 0;
+#ifdef FICLONERANGE
+	static int no_clone = 0;
+
+	/* A clone must start on a block boundary in both files, and must
+	 * be a whole number of blocks long (or end at the end of fd_in). */
+	if (!no_clone && offset % CLONE_ALIGN == 0) {
+		struct file_clone_range fcr;
+		OFF_T pos = do_lseek(f, 0, SEEK_CUR);
+		if (pos >= 0 && pos % CLONE_ALIGN == 0) {
+			fcr.src_fd = fd_in;
+			fcr.src_offset = offset;
+			fcr.src_length = len;
+			fcr.dest_offset = pos;
+			if (ioctl(f, FICLONERANGE, &fcr) == 0) {
+				if (do_lseek(f, pos + len, SEEK_SET) == pos + len)
+					return len;
+				return 0;
+			}
+			if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV)
+				no_clone = 1;
+		}
+	}
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+	while (done < len) {
+		loff_t off_in = offset + done;
+		ssize_t n = copy_file_range(fd_in, &off_in, f, NULL,
+					    (size_t)MIN(len - done, COPY_RANGE_MAX), 0);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		done += n;
+	}
+#endif
+
+	return done;
+}
+
+/* Returns 1 if copy_range() has a way to get the kernel to copy data. */
+int can_copy_range(void)
+{
+#if defined FICLONERANGE || defined HAVE_COPY_FILE_RANGE
+	return 1;
+#else
+	return 0;
+#endif
+}
+
 /* Copy a file.  If ofd < 0, copy_file unlinks and opens the "dest" file.
  * Otherwise, it just writes to and closes the provided file descriptor.
  * In either case, if --xattrs are being preserved, the dest file will
@@ -276,6 +341,8 @@ int copy_file(const char *source, const char *dest, int ofd,
 	int ifd;
 	char buf[1024 * 8];
 	int len;   /* Number of bytes read into `buf'. */
+	STRUCT_STAT st;
+	OFF_T done;
 
 	if ((ifd = do_open(source, O_RDONLY, 0)) < 0) {
 		int save_errno = errno;
@@ -309,6 +376,18 @@ int copy_file(const char *source, const char *dest, int ofd,
 		}
 	}
 
+	/* Let the kernel copy (or share) what it can, then read() the rest. */
+	if (do_fstat(ifd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+	 && (done = copy_range(ifd, 0, ofd, st.st_size)) > 0
+	 && do_lseek(ifd, done, SEEK_SET) != done) {
+		int save_errno = errno;
+		rsyserr(FERROR_XFER, errno, "lseek %s", full_fname(source));
+		close(ifd);
+		close(ofd);
+		errno = save_errno;
+		return -1;
+	}
+
 	while ((len = safe_read(ifd, buf, sizeof buf)) > 0) {
 		if (full_write(ofd, buf, len) < 0) {
 			int save_errno = errno;
@@ -461,7 +540,8 @@ pid_t do_fork(void)
 
 	if (newpid != 0  &&  newpid != -1) {
 		all_pids[num_pids++] = newpid;
-	}
+	} else if (newpid == 0)
+		evloop_reset();
 	return newpid;
 }
 
@@ -0,0 +1,119 @@
+/*
+ * A small pool of threads that helps out with CPU-bound loops.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+#include "rsync.h"
+
+#ifdef SUPPORT_THREADS
+/* The threads never touch the I/O code, the logging code, or anything else
+ * that isn't reentrant -- they only run the function handed to run_workers()
+ * on memory that the caller has set aside for them.  All signals are blocked
+ * in the threads so that they are always delivered to the main thread. */
+
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+
+static void (*work_fn)(void *arg, int ndx, int cnt);
+static void *work_arg;
+static int work_cnt, work_pending;
+static unsigned int work_gen;
+static int thread_cnt = -1;
+
+static void *worker_main(void *ptr)
+{
+	int ndx = (int)(long)ptr;
+	unsigned int gen = 0;
+
+	pthread_mutex_lock(&work_lock);
+	while (1) {
+		while (gen == work_gen)
+			pthread_cond_wait(&work_start, &work_lock);
+		gen = work_gen;
+		if (ndx >= work_cnt)
+			continue;
+		pthread_mutex_unlock(&work_lock);
+
+		work_fn(work_arg, ndx, work_cnt);
+
+		pthread_mutex_lock(&work_lock);
+		if (--work_pending == 0)
+			pthread_cond_signal(&work_done);
+	}
+
+	return NULL;
+}
+
+/* Start up to max_cnt-1 threads (the caller is the remaining worker). */
+static void start_workers(int max_cnt)
+{
+	sigset_t all, old;
+	pthread_t tid;
+
+	/* The threads leave the signals to the main thread, except for the
+	 * SIGBUS that reading a truncated --mmap file raises in the thread
+	 * that reads it (which has to reach our handler, since the kernel
+	 * kills the whole process for one that's blocked). */
+	sigfillset(&all);
+	sigdelset(&all, SIGBUS);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	for (thread_cnt = 0; thread_cnt < max_cnt - 1; thread_cnt++) {
+		if (pthread_create(&tid, NULL, worker_main, (void*)(long)(thread_cnt + 1)) != 0) {
+			rsyserr(FWARNING, errno,
+				"unable to start checksum thread %d", thread_cnt + 1);
+			break;
+		}
+		pthread_detach(tid);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+#endif
+
+/* Call fn(arg, ndx, cnt) once for every ndx in 0..cnt-1, spreading the calls
+ * over the worker threads, and return when they have all finished.  The
+ * caller's thread always handles ndx 0.  If threads are not available (or
+ * fewer could be started than were asked for), cnt is reduced accordingly,
+ * so fn must divide its work based on the cnt value it is passed. */
+void run_workers(int cnt, void (*fn)(void *arg, int ndx, int cnt), void *arg)
+{
+#ifdef SUPPORT_THREADS
+	if (thread_cnt < 0 && cnt > 1)
+		start_workers(MIN(cnt, MAX_CHECKSUM_THREADS));
+	if (cnt > thread_cnt + 1)
+		cnt = thread_cnt + 1;
+	if (cnt > 1) {
+		pthread_mutex_lock(&work_lock);
+		work_fn = fn;
+		work_arg = arg;
+		work_cnt = cnt;
+		work_pending = cnt - 1;
+		work_gen++;
+		pthread_cond_broadcast(&work_start);
+		pthread_mutex_unlock(&work_lock);
+
+		fn(arg, 0, cnt);
+
+		pthread_mutex_lock(&work_lock);
+		while (work_pending)
+			pthread_cond_wait(&work_done, &work_lock);
+		pthread_mutex_unlock(&work_lock);
+		return;
+	}
+#endif
+	fn(arg, 0, 1);
+}